@@ -1,11 +1,19 @@
 #pragma once
 #include <cassert>
 #include "Math.h"
+#include "SIMD.h"
 #include <iostream>
 namespace dae
 {
 	namespace BRDF
 	{
+		//Integer powers are multiplied out, std::powf goes through exp and log even for them
+		inline float Pow5(float x)
+		{
+			const float x2{ x * x };
+			return x2 * x2 * x;
+		}
+
 		/**
 		 * \param kd Diffuse Reflection Coefficient
 		 * \param cd Diffuse Color
@@ -53,7 +61,7 @@ namespace dae
 			float angle{ (Vector3::Dot(h, v)) };
 			if (angle < 0) angle = 0;
 			
-			return f0 + (ColorRGB{ 1,1,1 } - f0) * (std::powf(1 - angle, 5));
+			return f0 + (ColorRGB{ 1,1,1 } - f0) * Pow5(1 - angle);
 		}
 
 		/**
@@ -70,7 +78,7 @@ namespace dae
 			const float sqrtAngle{ angle * angle };
 
 			return (sqrtRoughness) / 
-				(PI * std::powf(( sqrtAngle * (sqrtRoughness - 1) + 1),2));
+				(PI * Square( sqrtAngle * (sqrtRoughness - 1) + 1));
 		}
 
 
@@ -110,5 +118,99 @@ namespace dae
 			return smith;
 		}
 
+		//Batch versions of the functions above, every call evaluates SIMD::NativeWidth shading points, one per lane
+		//Directions are normalized with a full square root like the scalar ones, non-integer powers use polynomial approximations
+		//Relative error of the materials shaded with them against a double precision evaluation, checked by SelfTest:
+		//Lambert 1e-6, Phong 2e-6 * (1 + exponent), Cook-Torrance 1e-5 + 5e-7 / roughness^4
+		//The roughness term is float cancellation in the GGX denominator as N.H nears 1, the scalar functions have it as well
+		namespace Wide
+		{
+			using SIMD::FloatN;
+
+			struct Vector3N
+			{
+				FloatN x, y, z;
+			};
+
+			struct ColorN
+			{
+				FloatN r, g, b;
+			};
+
+			inline Vector3N operator+(const Vector3N& v1, const Vector3N& v2) { return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z }; }
+			inline Vector3N operator-(const Vector3N& v1, const Vector3N& v2) { return { v1.x - v2.x, v1.y - v2.y, v1.z - v2.z }; }
+			inline Vector3N operator*(FloatN scale, const Vector3N& v) { return { scale * v.x, scale * v.y, scale * v.z }; }
+
+			inline ColorN operator+(const ColorN& c1, const ColorN& c2) { return { c1.r + c2.r, c1.g + c2.g, c1.b + c2.b }; }
+			inline ColorN operator*(const ColorN& c, FloatN scale) { return { c.r * scale, c.g * scale, c.b * scale }; }
+
+			inline ColorN Broadcast(const ColorRGB& color)
+			{
+				return { SIMD::Broadcast(color.r), SIMD::Broadcast(color.g), SIMD::Broadcast(color.b) };
+			}
+
+			inline FloatN Dot(const Vector3N& v1, const Vector3N& v2)
+			{
+				return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+			}
+
+			//The reciprocal square root estimate is off by 5e-7 even after refinement, too much for the cancellation at the GGX peak
+			inline Vector3N Normalized(const Vector3N& v)
+			{
+				const FloatN length{ SIMD::Sqrt(Dot(v, v)) };
+				return { v.x / length, v.y / length, v.z / length };
+			}
+
+			//Lambert doesn't depend on the shading point, the batch version only has the per lane reflectance
+			inline ColorN Lambert(const ColorN& kd, const ColorRGB& cd)
+			{
+				ColorRGB scale{ cd };
+				scale /= PI;
+				return { kd.r * SIMD::Broadcast(scale.r), kd.g * SIMD::Broadcast(scale.g), kd.b * SIMD::Broadcast(scale.b) };
+			}
+
+			//Phong Specular, the same for every color component
+			inline FloatN Phong(float ks, float exp, const Vector3N& l, const Vector3N& v, const Vector3N& n)
+			{
+				const Vector3N reflect{ l - (SIMD::Broadcast(2.f) * Dot(n, l)) * n };
+				const FloatN cosAngle{ SIMD::Max(Dot(reflect, v), SIMD::Broadcast(0.f)) };
+
+				return SIMD::Broadcast(ks) * SIMD::Pow(cosAngle, exp);
+			}
+
+			inline ColorN FresnelFunction_Schlick(const Vector3N& h, const Vector3N& v, const ColorRGB& f0)
+			{
+				const FloatN angle{ SIMD::Max(Dot(h, v), SIMD::Broadcast(0.f)) };
+				const FloatN factor{ SIMD::PowInteger(SIMD::Broadcast(1.f) - angle, 5) };
+
+				const ColorRGB range{ ColorRGB{ 1,1,1 } - f0 };
+				return {
+					SIMD::Broadcast(f0.r) + SIMD::Broadcast(range.r) * factor,
+					SIMD::Broadcast(f0.g) + SIMD::Broadcast(range.g) * factor,
+					SIMD::Broadcast(f0.b) + SIMD::Broadcast(range.b) * factor };
+			}
+
+			inline FloatN NormalDistribution_GGX(const Vector3N& n, const Vector3N& h, float roughness)
+			{
+				const float sqrtRoughness{ roughness * roughness };
+				const FloatN angle{ Dot(n, h) };
+				const FloatN denominator{ angle * angle * SIMD::Broadcast(sqrtRoughness - 1) + SIMD::Broadcast(1.f) };
+
+				return SIMD::Broadcast(sqrtRoughness / PI) / (denominator * denominator);
+			}
+
+			inline FloatN GeometryFunction_SchlickGGX(const Vector3N& n, const Vector3N& v, float roughness)
+			{
+				const FloatN angle{ SIMD::Max(Dot(n, v), SIMD::Broadcast(0.f)) };
+				const float k{ ((roughness + 1) * (roughness + 1)) / 8.0f };
+
+				return angle / (angle * SIMD::Broadcast(1 - k) + SIMD::Broadcast(k));
+			}
+
+			inline FloatN GeometryFunction_Smith(const Vector3N& n, const Vector3N& v, const Vector3N& l, float roughness)
+			{
+				return GeometryFunction_SchlickGGX(n, v, roughness) * GeometryFunction_SchlickGGX(n, l, roughness);
+			}
+		}
 	}
 }
\ No newline at end of file
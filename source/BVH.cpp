@@ -1,24 +1,676 @@
 #include "BVH.h"
 #include "Utils.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include "RayPacket.h"
+#include "SIMD.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
-dae::BVH::BVH(dae::TriangleMesh& mesh)
-	: m_NTris{ static_cast<uint32_t>(mesh.normals.size()) }
+namespace
+{
+	//Nodes with at least this many triangles are bounded, binned and partitioned by all threads
+	constexpr uint32_t ParallelNodeThreshold{ 1u << 15 };
+	//Subtrees with at least this many triangles are built as their own task
+	constexpr uint32_t ParallelSubtreeThreshold{ 1u << 10 };
+	//Refits split the tree over the thread pool down to this depth
+	constexpr uint32_t ParallelRefitDepth{ 4 };
+	//Wide BVH levels collapsed by the calling thread, every subtree below them is collapsed by its own task
+	constexpr uint32_t ParallelCollapseDepth{ 3 };
+	//Triangles per chunk for the parallel node operations
+	constexpr uint32_t ParallelChunkSize{ 1u << 13 };
+
+	uint32_t GetNumChunks(uint32_t count)
+	{
+		return (count + ParallelChunkSize - 1) / ParallelChunkSize;
+	}
+
+	//Reduces every chunk of [first, first + count) on the thread pool, then merges the chunk results in order
+	template<typename T, typename ChunkFunction, typename MergeFunction>
+	T ParallelReduce(uint32_t first, uint32_t count, ChunkFunction chunkFunction, MergeFunction mergeFunction)
+	{
+		const uint32_t numChunks{ GetNumChunks(count) };
+		std::vector<T> chunkResults(numChunks);
+
+		dae::ThreadPool::Get().ParallelFor(0, numChunks, 1, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t chunk = begin; chunk < end; ++chunk)
+			{
+				const uint32_t chunkFirst{ chunk * ParallelChunkSize };
+				chunkResults[chunk] = chunkFunction(first + chunkFirst, std::min(ParallelChunkSize, count - chunkFirst));
+			}
+		});
+
+		for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+		{
+			mergeFunction(chunkResults[0], chunkResults[chunk]);
+		}
+		return chunkResults[0];
+	}
+
+	//Bits of the Morton code per axis, 3 * 10 bits fit in the upper half of a 64 bit sort key
+	constexpr uint32_t MortonAxisBits{ 10 };
+	constexpr uint32_t MortonBits{ MortonAxisBits * 3 };
+	//LBVH leaves are only split further while they hold more triangles than this
+	constexpr uint32_t LBVHMaxLeafSize{ 4 };
+
+	//LSD radix sort on the Morton code in the upper half of the keys, every pass counts and scatters the chunks in parallel
+	//sorted and offsets are scratch, passing the same vectors every time avoids reallocating them
+	void SortMortonKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& sorted, std::vector<uint32_t>& offsets)
+	{
+		constexpr uint32_t RadixBits{ 8 };
+		constexpr uint32_t RadixSize{ 1u << RadixBits };
+
+		const uint32_t count{ static_cast<uint32_t>(keys.size()) };
+		const uint32_t numChunks{ GetNumChunks(count) };
+		dae::ThreadPool& threadPool{ dae::ThreadPool::Get() };
+
+		sorted.resize(count);
+		offsets.resize(numChunks * RadixSize);
+
+		for (uint32_t shift = 32; shift < 32 + MortonBits; shift += RadixBits)
+		{
+			std::fill(offsets.begin(), offsets.end(), 0);
+
+			threadPool.ParallelFor(0, numChunks, 1, [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t chunk = begin; chunk < end; ++chunk)
+				{
+					uint32_t* chunkCounts{ &offsets[chunk * RadixSize] };
+					const uint32_t chunkEnd{ std::min((chunk + 1) * ParallelChunkSize, count) };
+					for (uint32_t i = chunk * ParallelChunkSize; i < chunkEnd; ++i)
+					{
+						++chunkCounts[(keys[i] >> shift) & (RadixSize - 1)];
+					}
+				}
+			});
+
+			//digit major prefix sum, so every chunk scatters into its own range and the sort stays stable
+			uint32_t offset{ 0 };
+			for (uint32_t digit = 0; digit < RadixSize; ++digit)
+			{
+				for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+				{
+					const uint32_t digitCount{ offsets[chunk * RadixSize + digit] };
+					offsets[chunk * RadixSize + digit] = offset;
+					offset += digitCount;
+				}
+			}
+
+			threadPool.ParallelFor(0, numChunks, 1, [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t chunk = begin; chunk < end; ++chunk)
+				{
+					uint32_t* chunkOffsets{ &offsets[chunk * RadixSize] };
+					const uint32_t chunkEnd{ std::min((chunk + 1) * ParallelChunkSize, count) };
+					for (uint32_t i = chunk * ParallelChunkSize; i < chunkEnd; ++i)
+					{
+						sorted[chunkOffsets[(keys[i] >> shift) & (RadixSize - 1)]++] = keys[i];
+					}
+				}
+			});
+
+			keys.swap(sorted);
+		}
+	}
+
+	struct Bin
+	{
+		dae::AABB bounds{};
+		uint32_t triCount{ 0 };
+	};
+
+	struct BinSet
+	{
+		Bin bins[3][dae::BVHBuildSettings::MaxBinCount]{};
+	};
+
+	uint32_t CountTrailingZeros(uint32_t mask)
+	{
+		uint32_t count{ 0 };
+		while ((mask & 1u) == 0)
+		{
+			mask >>= 1;
+			++count;
+		}
+		return count;
+	}
+
+	//Ray origin, direction, reciprocal direction and range splatted across SIMD lanes, set up once per traversal
+	//The cull mode is stored as two lane masks, a triangle is kept if the mask for its facing is set
+	struct WideRay
+	{
+		WideRay(const dae::Ray& ray, dae::TriangleCullMode cullMode) :
+			origin{ ray.origin }, reciproke{ ray.reciproke }, cullMode{ cullMode }
+#if defined(DAE_SIMD_SSE)
+			, ox4{ _mm_set1_ps(ray.origin.x) }, oy4{ _mm_set1_ps(ray.origin.y) }, oz4{ _mm_set1_ps(ray.origin.z) }
+			, rx4{ _mm_set1_ps(ray.reciproke.x) }, ry4{ _mm_set1_ps(ray.reciproke.y) }, rz4{ _mm_set1_ps(ray.reciproke.z) }
+			, dx4{ _mm_set1_ps(ray.direction.x) }, dy4{ _mm_set1_ps(ray.direction.y) }, dz4{ _mm_set1_ps(ray.direction.z) }
+			, min4{ _mm_set1_ps(ray.min) }, max4{ _mm_set1_ps(ray.max) }
+			, keepFront4{ _mm_castsi128_ps(_mm_set1_epi32(cullMode == dae::TriangleCullMode::FrontFaceCulling ? 0 : -1)) }
+			, keepBack4{ _mm_castsi128_ps(_mm_set1_epi32(cullMode == dae::TriangleCullMode::BackFaceCulling ? 0 : -1)) }
+#endif
+#if defined(DAE_SIMD_AVX)
+			, ox8{ _mm256_set1_ps(ray.origin.x) }, oy8{ _mm256_set1_ps(ray.origin.y) }, oz8{ _mm256_set1_ps(ray.origin.z) }
+			, rx8{ _mm256_set1_ps(ray.reciproke.x) }, ry8{ _mm256_set1_ps(ray.reciproke.y) }, rz8{ _mm256_set1_ps(ray.reciproke.z) }
+			, dx8{ _mm256_set1_ps(ray.direction.x) }, dy8{ _mm256_set1_ps(ray.direction.y) }, dz8{ _mm256_set1_ps(ray.direction.z) }
+			, min8{ _mm256_set1_ps(ray.min) }, max8{ _mm256_set1_ps(ray.max) }
+			, keepFront8{ _mm256_castsi256_ps(_mm256_set1_epi32(cullMode == dae::TriangleCullMode::FrontFaceCulling ? 0 : -1)) }
+			, keepBack8{ _mm256_castsi256_ps(_mm256_set1_epi32(cullMode == dae::TriangleCullMode::BackFaceCulling ? 0 : -1)) }
+#endif
+		{
+		}
+
+		dae::Vector3 origin;
+		dae::Vector3 reciproke;
+		dae::TriangleCullMode cullMode;
+#if defined(DAE_SIMD_SSE)
+		__m128 ox4, oy4, oz4, rx4, ry4, rz4, dx4, dy4, dz4, min4, max4, keepFront4, keepBack4;
+#endif
+#if defined(DAE_SIMD_AVX)
+		__m256 ox8, oy8, oz8, rx8, ry8, rz8, dx8, dy8, dz8, min8, max8, keepFront8, keepBack8;
+#endif
+	};
+
+	/**
+	 * \brief Slab test of the ray against every child box of a wide node
+	 * \param tClosest children starting beyond the closest hit so far are rejected
+	 * \param dist receives the entry distance of every child
+	 * \return bitmask of the hit children
+	 */
+	template<uint32_t Width>
+	uint32_t IntersectChildren(const dae::WideBVHNode<Width>& node, const WideRay& ray, float tClosest, float* dist)
+	{
+		const uint32_t validMask{ (1u << node.childCount) - 1 };
+
+#if defined(DAE_SIMD_AVX)
+		if constexpr (Width == 8)
+		{
+			const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), ray.ox8), ray.rx8);
+			const __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), ray.ox8), ray.rx8);
+			const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), ray.oy8), ray.ry8);
+			const __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), ray.oy8), ray.ry8);
+			const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), ray.oz8), ray.rz8);
+			const __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), ray.oz8), ray.rz8);
+
+			const __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+			const __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+			const __m256 hit = _mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ)),
+				_mm256_cmp_ps(tmin, _mm256_set1_ps(tClosest), _CMP_LT_OQ));
+
+			_mm256_storeu_ps(dist, tmin);
+			return static_cast<uint32_t>(_mm256_movemask_ps(hit)) & validMask;
+		}
+#endif
+#if defined(DAE_SIMD_SSE)
+		if constexpr (Width % 4 == 0)
+		{
+			//8 wide nodes without AVX are tested as two SSE halves
+			uint32_t hitMask{ 0 };
+			for (uint32_t i = 0; i < Width; i += 4)
+			{
+				const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX + i), ray.ox4), ray.rx4);
+				const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX + i), ray.ox4), ray.rx4);
+				const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY + i), ray.oy4), ray.ry4);
+				const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY + i), ray.oy4), ray.ry4);
+				const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ + i), ray.oz4), ray.rz4);
+				const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ + i), ray.oz4), ray.rz4);
+
+				const __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+				const __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+				const __m128 hit = _mm_and_ps(
+					_mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpgt_ps(tmax, _mm_setzero_ps())),
+					_mm_cmplt_ps(tmin, _mm_set1_ps(tClosest)));
+
+				_mm_storeu_ps(dist + i, tmin);
+				hitMask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << i;
+			}
+			return hitMask & validMask;
+		}
+#endif
+		uint32_t hitMask{ 0 };
+		for (uint32_t i = 0; i < node.childCount; ++i)
+		{
+			const float tx1{ (node.minX[i] - ray.origin.x) * ray.reciproke.x }, tx2{ (node.maxX[i] - ray.origin.x) * ray.reciproke.x };
+			const float ty1{ (node.minY[i] - ray.origin.y) * ray.reciproke.y }, ty2{ (node.maxY[i] - ray.origin.y) * ray.reciproke.y };
+			const float tz1{ (node.minZ[i] - ray.origin.z) * ray.reciproke.z }, tz2{ (node.maxZ[i] - ray.origin.z) * ray.reciproke.z };
+
+			const float tmin{ std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2)) };
+			const float tmax{ std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2)) };
+
+			dist[i] = tmin;
+			if (tmax >= tmin && tmax > 0 && tmin < tClosest) hitMask |= 1u << i;
+		}
+		return hitMask;
+	}
+
+#if defined(DAE_SIMD_SSE)
+	//Moller-Trumbore on 4 lanes, same operations in the same order as GeometryUtils::HitTest_Triangle
+	//Rejections are written as negated compares (NLT, NGT) so NaNs pass them exactly like the scalar early outs
+	__m128 IntersectTriangles4(const dae::TriangleBlock<4>& block, const WideRay& ray, float tClosest, __m128& t)
+	{
+		const __m128 e1x = _mm_load_ps(block.edge1X), e1y = _mm_load_ps(block.edge1Y), e1z = _mm_load_ps(block.edge1Z);
+		const __m128 e2x = _mm_load_ps(block.edge2X), e2y = _mm_load_ps(block.edge2Y), e2z = _mm_load_ps(block.edge2Z);
+
+		//tVec = direction x edge2
+		const __m128 tx = _mm_sub_ps(_mm_mul_ps(ray.dy4, e2z), _mm_mul_ps(ray.dz4, e2y));
+		const __m128 ty = _mm_sub_ps(_mm_mul_ps(ray.dz4, e2x), _mm_mul_ps(ray.dx4, e2z));
+		const __m128 tz = _mm_sub_ps(_mm_mul_ps(ray.dx4, e2y), _mm_mul_ps(ray.dy4, e2x));
+		const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, tx), _mm_mul_ps(e1y, ty)), _mm_mul_ps(e1z, tz));
+
+		//not parallel, facing kept by the cull mode
+		const __m128 isBackFacing = _mm_cmplt_ps(determinant, _mm_setzero_ps());
+		__m128 mask = _mm_or_ps(_mm_cmpngt_ps(determinant, _mm_set1_ps(-.01f)), _mm_cmpnlt_ps(determinant, _mm_set1_ps(.01f)));
+		mask = _mm_and_ps(mask, _mm_or_ps(_mm_and_ps(isBackFacing, ray.keepBack4), _mm_andnot_ps(isBackFacing, ray.keepFront4)));
+
+		const __m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.f), determinant);
+		const __m128 ox = _mm_sub_ps(ray.ox4, _mm_load_ps(block.v0X));
+		const __m128 oy = _mm_sub_ps(ray.oy4, _mm_load_ps(block.v0Y));
+		const __m128 oz = _mm_sub_ps(ray.oz4, _mm_load_ps(block.v0Z));
+
+		const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, tx), _mm_mul_ps(oy, ty)), _mm_mul_ps(oz, tz)), invDeterminant);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(u, _mm_setzero_ps()), _mm_cmpngt_ps(u, _mm_set1_ps(1.f))));
+
+		//qVec = v0ToOrigin x edge1
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(oy, e1z), _mm_mul_ps(oz, e1y));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(oz, e1x), _mm_mul_ps(ox, e1z));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(ox, e1y), _mm_mul_ps(oy, e1x));
+
+		const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.dx4, qx), _mm_mul_ps(ray.dy4, qy)), _mm_mul_ps(ray.dz4, qz)), invDeterminant);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(v, _mm_setzero_ps()), _mm_cmpngt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f))));
+
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDeterminant);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(t, ray.min4), _mm_cmpngt_ps(_mm_mul_ps(t, t), ray.max4)));
+		return _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tClosest)));
+	}
+#endif
+
+#if defined(DAE_SIMD_AVX)
+	//8 lane version of IntersectTriangles4
+	__m256 IntersectTriangles8(const dae::TriangleBlock<8>& block, const WideRay& ray, float tClosest, __m256& t)
+	{
+		const __m256 e1x = _mm256_load_ps(block.edge1X), e1y = _mm256_load_ps(block.edge1Y), e1z = _mm256_load_ps(block.edge1Z);
+		const __m256 e2x = _mm256_load_ps(block.edge2X), e2y = _mm256_load_ps(block.edge2Y), e2z = _mm256_load_ps(block.edge2Z);
+
+		const __m256 tx = _mm256_sub_ps(_mm256_mul_ps(ray.dy8, e2z), _mm256_mul_ps(ray.dz8, e2y));
+		const __m256 ty = _mm256_sub_ps(_mm256_mul_ps(ray.dz8, e2x), _mm256_mul_ps(ray.dx8, e2z));
+		const __m256 tz = _mm256_sub_ps(_mm256_mul_ps(ray.dx8, e2y), _mm256_mul_ps(ray.dy8, e2x));
+		const __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, tx), _mm256_mul_ps(e1y, ty)), _mm256_mul_ps(e1z, tz));
+
+		const __m256 isBackFacing = _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_LT_OQ);
+		__m256 mask = _mm256_or_ps(_mm256_cmp_ps(determinant, _mm256_set1_ps(-.01f), _CMP_NGT_UQ), _mm256_cmp_ps(determinant, _mm256_set1_ps(.01f), _CMP_NLT_UQ));
+		mask = _mm256_and_ps(mask, _mm256_blendv_ps(ray.keepFront8, ray.keepBack8, isBackFacing));
+
+		const __m256 invDeterminant = _mm256_div_ps(_mm256_set1_ps(1.f), determinant);
+		const __m256 ox = _mm256_sub_ps(ray.ox8, _mm256_load_ps(block.v0X));
+		const __m256 oy = _mm256_sub_ps(ray.oy8, _mm256_load_ps(block.v0Y));
+		const __m256 oz = _mm256_sub_ps(ray.oz8, _mm256_load_ps(block.v0Z));
+
+		const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, tx), _mm256_mul_ps(oy, ty)), _mm256_mul_ps(oz, tz)), invDeterminant);
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_NLT_UQ), _mm256_cmp_ps(u, _mm256_set1_ps(1.f), _CMP_NGT_UQ)));
+
+		const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(oy, e1z), _mm256_mul_ps(oz, e1y));
+		const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(oz, e1x), _mm256_mul_ps(ox, e1z));
+		const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(ox, e1y), _mm256_mul_ps(oy, e1x));
+
+		const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ray.dx8, qx), _mm256_mul_ps(ray.dy8, qy)), _mm256_mul_ps(ray.dz8, qz)), invDeterminant);
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NLT_UQ), _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.f), _CMP_NGT_UQ)));
+
+		t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDeterminant);
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, ray.min8, _CMP_NLT_UQ), _mm256_cmp_ps(_mm256_mul_ps(t, t), ray.max8, _CMP_NGT_UQ)));
+		return _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tClosest), _CMP_LT_OQ));
+	}
+#endif
+
+	/**
+	 * \brief Tests the ray against every triangle of a leaf block
+	 * \param ray only read by the scalar fallback
+	 * \param tClosest only hits closer than this count, lowered to the closest one found
+	 * \param lane receives the lane of the closest hit
+	 * \return whether any lane was hit closer than tClosest
+	 */
+	template<uint32_t Width>
+	bool IntersectTriangleBlock(const dae::TriangleBlock<Width>& block, const dae::Ray& ray, const WideRay& wideRay, float& tClosest, uint32_t& lane)
+	{
+#if defined(DAE_SIMD_AVX)
+		if constexpr (Width == 8)
+		{
+			__m256 t;
+			const __m256 hit = IntersectTriangles8(block, wideRay, tClosest, t);
+			const uint32_t hitMask{ static_cast<uint32_t>(_mm256_movemask_ps(hit)) };
+			if (hitMask == 0) return false;
+
+			//masked min reduction: missed lanes become +inf, the minimum is spread over all lanes and matched back to its lane
+			__m256 minT = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, hit);
+			minT = _mm256_min_ps(minT, _mm256_permute_ps(minT, _MM_SHUFFLE(2, 3, 0, 1)));
+			minT = _mm256_min_ps(minT, _mm256_permute_ps(minT, _MM_SHUFFLE(1, 0, 3, 2)));
+			minT = _mm256_min_ps(minT, _mm256_permute2f128_ps(minT, minT, 0x01));
+
+			lane = CountTrailingZeros(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t, minT, _CMP_EQ_OQ))) & hitMask);
+			tClosest = _mm256_cvtss_f32(minT);
+			return true;
+		}
+#endif
+#if defined(DAE_SIMD_SSE)
+		if constexpr (Width == 4)
+		{
+			__m128 t;
+			const __m128 hit = IntersectTriangles4(block, wideRay, tClosest, t);
+			const uint32_t hitMask{ static_cast<uint32_t>(_mm_movemask_ps(hit)) };
+			if (hitMask == 0) return false;
+
+			__m128 minT = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX)));
+			minT = _mm_min_ps(minT, _mm_shuffle_ps(minT, minT, _MM_SHUFFLE(2, 3, 0, 1)));
+			minT = _mm_min_ps(minT, _mm_shuffle_ps(minT, minT, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			lane = CountTrailingZeros(static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpeq_ps(t, minT))) & hitMask);
+			tClosest = _mm_cvtss_f32(minT);
+			return true;
+		}
+#endif
+		bool didHit{ false };
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			const dae::PackedTriangle triangle{
+				{ block.v0X[i], block.v0Y[i], block.v0Z[i] },
+				{ block.edge1X[i], block.edge1Y[i], block.edge1Z[i] },
+				{ block.edge2X[i], block.edge2Y[i], block.edge2Z[i] } };
+
+			float t;
+			if (dae::GeometryUtils::HitTest_PackedTriangle(triangle, wideRay.cullMode, ray, t) && t < tClosest)
+			{
+				tClosest = t;
+				lane = i;
+				didHit = true;
+			}
+		}
+		return didHit;
+	}
+
+	//Any hit version of IntersectTriangleBlock, skips the search for the closest lane
+	template<uint32_t Width>
+	bool DoesHitTriangleBlock(const dae::TriangleBlock<Width>& block, const dae::Ray& ray, const WideRay& wideRay)
+	{
+#if defined(DAE_SIMD_AVX)
+		if constexpr (Width == 8)
+		{
+			__m256 t;
+			return _mm256_movemask_ps(IntersectTriangles8(block, wideRay, FLT_MAX, t)) != 0;
+		}
+#endif
+#if defined(DAE_SIMD_SSE)
+		if constexpr (Width == 4)
+		{
+			__m128 t;
+			return _mm_movemask_ps(IntersectTriangles4(block, wideRay, FLT_MAX, t)) != 0;
+		}
+#endif
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			const dae::PackedTriangle triangle{
+				{ block.v0X[i], block.v0Y[i], block.v0Z[i] },
+				{ block.edge1X[i], block.edge1Y[i], block.edge1Z[i] },
+				{ block.edge2X[i], block.edge2Y[i], block.edge2Z[i] } };
+
+			float t;
+			if (dae::GeometryUtils::HitTest_PackedTriangle(triangle, wideRay.cullMode, ray, t) && t < FLT_MAX) return true;
+		}
+		return false;
+	}
+
+	//Boxes entered beyond ray.max (a squared distance) hold no hit, squaring is monotonic so no accepted hit is culled
+	bool IsBeyondMax(float dist, const dae::Ray& ray)
+	{
+		return dist > 0 && dist * dist > ray.max;
+	}
+
+	/**
+	 * \brief Tests one triangle against the rays in rayMask, same operations as GeometryUtils::HitTest_Triangle
+	 * Every ray starts at the packet origin, so the terms that only depend on it are computed once for the whole packet
+	 * \param closestT per ray, lowered where the triangle is hit closer
+	 * \param closestSlot per ray, set to slot where the triangle is hit closer
+	 */
+	void IntersectTrianglePacket(const dae::PackedTriangle& triangle, dae::TriangleCullMode cullMode, const dae::RayPacket& packet, uint32_t rayMask,
+		uint32_t slot, float* closestT, uint32_t* closestSlot)
+	{
+		using dae::Vector3;
+		const Vector3 v0ToOrigin{ packet.origin - triangle.v0 };
+		const Vector3 qVec{ Vector3::Cross(v0ToOrigin, triangle.edge1) };
+		const float tNumerator{ Vector3::Dot(triangle.edge2, qVec) };
+
+#if defined(DAE_SIMD_AVX)
+		constexpr uint32_t Lanes{ 8 };
+		const __m256 e1x = _mm256_set1_ps(triangle.edge1.x), e1y = _mm256_set1_ps(triangle.edge1.y), e1z = _mm256_set1_ps(triangle.edge1.z);
+		const __m256 e2x = _mm256_set1_ps(triangle.edge2.x), e2y = _mm256_set1_ps(triangle.edge2.y), e2z = _mm256_set1_ps(triangle.edge2.z);
+		const __m256 ox = _mm256_set1_ps(v0ToOrigin.x), oy = _mm256_set1_ps(v0ToOrigin.y), oz = _mm256_set1_ps(v0ToOrigin.z);
+		const __m256 qx = _mm256_set1_ps(qVec.x), qy = _mm256_set1_ps(qVec.y), qz = _mm256_set1_ps(qVec.z);
+		const __m256 keepFront = _mm256_castsi256_ps(_mm256_set1_epi32(cullMode == dae::TriangleCullMode::FrontFaceCulling ? 0 : -1));
+		const __m256 keepBack = _mm256_castsi256_ps(_mm256_set1_epi32(cullMode == dae::TriangleCullMode::BackFaceCulling ? 0 : -1));
+		const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+
+		for (uint32_t i = 0; i < dae::RayPacket::Size; i += Lanes)
+		{
+			const uint32_t laneMask{ (rayMask >> i) & ((1u << Lanes) - 1) };
+			if (laneMask == 0) continue;
+
+			const __m256 dx = _mm256_load_ps(packet.directionX + i), dy = _mm256_load_ps(packet.directionY + i), dz = _mm256_load_ps(packet.directionZ + i);
+
+			//tVec = direction x edge2
+			const __m256 tx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+			const __m256 ty = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+			const __m256 tz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+			const __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, tx), _mm256_mul_ps(e1y, ty)), _mm256_mul_ps(e1z, tz));
+
+			const __m256 isBackFacing = _mm256_cmp_ps(determinant, zero, _CMP_LT_OQ);
+			__m256 mask = _mm256_or_ps(_mm256_cmp_ps(determinant, _mm256_set1_ps(-.01f), _CMP_NGT_UQ), _mm256_cmp_ps(determinant, _mm256_set1_ps(.01f), _CMP_NLT_UQ));
+			mask = _mm256_and_ps(mask, _mm256_blendv_ps(keepFront, keepBack, isBackFacing));
+
+			const __m256 invDeterminant = _mm256_div_ps(one, determinant);
+
+			const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, tx), _mm256_mul_ps(oy, ty)), _mm256_mul_ps(oz, tz)), invDeterminant);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_NLT_UQ), _mm256_cmp_ps(u, one, _CMP_NGT_UQ)));
+
+			const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDeterminant);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_NLT_UQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_NGT_UQ)));
+
+			const __m256 t = _mm256_mul_ps(_mm256_set1_ps(tNumerator), invDeterminant);
+			mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_load_ps(packet.min + i), _CMP_NLT_UQ), _mm256_cmp_ps(_mm256_mul_ps(t, t), _mm256_load_ps(packet.max + i), _CMP_NGT_UQ)));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_loadu_ps(closestT + i), _CMP_LT_OQ));
+
+			uint32_t hitMask{ static_cast<uint32_t>(_mm256_movemask_ps(mask)) & laneMask };
+			if (hitMask == 0) continue;
+
+			alignas(32) float tLanes[Lanes];
+			_mm256_store_ps(tLanes, t);
+			for (; hitMask; hitMask &= hitMask - 1)
+			{
+				const uint32_t lane{ CountTrailingZeros(hitMask) };
+				closestT[i + lane] = tLanes[lane];
+				closestSlot[i + lane] = slot;
+			}
+		}
+#elif defined(DAE_SIMD_SSE)
+		constexpr uint32_t Lanes{ 4 };
+		const __m128 e1x = _mm_set1_ps(triangle.edge1.x), e1y = _mm_set1_ps(triangle.edge1.y), e1z = _mm_set1_ps(triangle.edge1.z);
+		const __m128 e2x = _mm_set1_ps(triangle.edge2.x), e2y = _mm_set1_ps(triangle.edge2.y), e2z = _mm_set1_ps(triangle.edge2.z);
+		const __m128 ox = _mm_set1_ps(v0ToOrigin.x), oy = _mm_set1_ps(v0ToOrigin.y), oz = _mm_set1_ps(v0ToOrigin.z);
+		const __m128 qx = _mm_set1_ps(qVec.x), qy = _mm_set1_ps(qVec.y), qz = _mm_set1_ps(qVec.z);
+		const __m128 keepFront = _mm_castsi128_ps(_mm_set1_epi32(cullMode == dae::TriangleCullMode::FrontFaceCulling ? 0 : -1));
+		const __m128 keepBack = _mm_castsi128_ps(_mm_set1_epi32(cullMode == dae::TriangleCullMode::BackFaceCulling ? 0 : -1));
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+
+		for (uint32_t i = 0; i < dae::RayPacket::Size; i += Lanes)
+		{
+			const uint32_t laneMask{ (rayMask >> i) & ((1u << Lanes) - 1) };
+			if (laneMask == 0) continue;
+
+			const __m128 dx = _mm_load_ps(packet.directionX + i), dy = _mm_load_ps(packet.directionY + i), dz = _mm_load_ps(packet.directionZ + i);
+
+			const __m128 tx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			const __m128 ty = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			const __m128 tz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, tx), _mm_mul_ps(e1y, ty)), _mm_mul_ps(e1z, tz));
+
+			const __m128 isBackFacing = _mm_cmplt_ps(determinant, zero);
+			__m128 mask = _mm_or_ps(_mm_cmpngt_ps(determinant, _mm_set1_ps(-.01f)), _mm_cmpnlt_ps(determinant, _mm_set1_ps(.01f)));
+			mask = _mm_and_ps(mask, _mm_or_ps(_mm_and_ps(isBackFacing, keepBack), _mm_andnot_ps(isBackFacing, keepFront)));
+
+			const __m128 invDeterminant = _mm_div_ps(one, determinant);
+
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, tx), _mm_mul_ps(oy, ty)), _mm_mul_ps(oz, tz)), invDeterminant);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(u, zero), _mm_cmpngt_ps(u, one)));
+
+			const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDeterminant);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(v, zero), _mm_cmpngt_ps(_mm_add_ps(u, v), one)));
+
+			const __m128 t = _mm_mul_ps(_mm_set1_ps(tNumerator), invDeterminant);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpnlt_ps(t, _mm_load_ps(packet.min + i)), _mm_cmpngt_ps(_mm_mul_ps(t, t), _mm_load_ps(packet.max + i))));
+			mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_loadu_ps(closestT + i)));
+
+			uint32_t hitMask{ static_cast<uint32_t>(_mm_movemask_ps(mask)) & laneMask };
+			if (hitMask == 0) continue;
+
+			alignas(16) float tLanes[Lanes];
+			_mm_store_ps(tLanes, t);
+			for (; hitMask; hitMask &= hitMask - 1)
+			{
+				const uint32_t lane{ CountTrailingZeros(hitMask) };
+				closestT[i + lane] = tLanes[lane];
+				closestSlot[i + lane] = slot;
+			}
+		}
+#else
+		for (; rayMask; rayMask &= rayMask - 1)
+		{
+			const uint32_t i{ CountTrailingZeros(rayMask) };
+
+			float t;
+			if (dae::GeometryUtils::HitTest_PackedTriangle(triangle, cullMode, packet.GetRay(i), t) && t < closestT[i])
+			{
+				closestT[i] = t;
+				closestSlot[i] = slot;
+			}
+		}
+		(void)tNumerator;
+#endif
+	}
+
+	//Cache file layout: header, BVHNode[nodesUsed], uint32_t triIdx[numTris], Triangle[numTris]
+	//Bump the version whenever the layout of the header, BVHNode, Triangle or the builders changes
+	constexpr char CacheMagic[4]{ 'B', 'V', 'H', 'C' };
+	constexpr uint32_t CacheVersion{ 1 };
+
+	struct CacheHeader
+	{
+		char magic[4]{};
+		uint32_t version{};
+		uint64_t cacheKey{};
+		uint32_t nodeSize{};
+		uint32_t triangleSize{};
+		uint32_t numTris{};
+		uint32_t nodesUsed{};
+	};
+
+	//FNV-1a
+	uint64_t HashBytes(const void* pData, size_t size, uint64_t hash = 14695981039346656037ull)
+	{
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= pBytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
+
+dae::BVH::BVH(dae::TriangleMesh& mesh, const BVHBuildSettings& settings)
+	: m_Settings{ settings }
 	, m_Mesh{mesh}
+	, m_NTris{ static_cast<uint32_t>(mesh.normals.size()) }
+{
+	m_Settings.binCount = std::clamp(m_Settings.binCount, 2u, BVHBuildSettings::MaxBinCount);
+
+	m_BvhNodes = new BVHNode[m_NTris * 2 - 1];
+	m_Tris = new Triangle[m_NTris];
+	m_TriIdx = new uint32_t[m_NTris];
+
+	const bool useCache{ !m_Settings.cacheDirectory.empty() };
+	const uint64_t cacheKey{ useCache ? CalculateCacheKey(mesh) : 0 };
+
+	if (!useCache || !LoadFromCache(cacheKey))
+	{
+		GenerateTriangles(mesh);
+		for (uint32_t i = 0; i < m_NTris; ++i) m_TriIdx[i] = i;
+		BuildBVH();
+
+		if (useCache) SaveToCache(cacheKey);
+	}
+
+	m_BuildCost = m_Cost = CalculateCost(m_RootNodeIdx) / m_BvhNodes[m_RootNodeIdx].bounds.area();
+	UpdateLeafLayout();
+	UpdateLeafTriangles();
+	CollapseToWideBVH();
+}
+
+dae::BVH::BVH(TriangleMesh& mesh, const BVHBuildSettings& settings, std::vector<Triangle>&& triangles)
+	: m_Settings{ settings }
+	, m_Mesh{ mesh }
+	, m_NTris{ static_cast<uint32_t>(triangles.size()) }
+	, m_SerialBuild{ true }
 {
 	m_BvhNodes = new BVHNode[m_NTris * 2 - 1];
 	m_Tris = new Triangle[m_NTris];
 	m_TriIdx = new uint32_t[m_NTris];
 
-	GenerateTriangles(mesh);
+	std::copy(triangles.begin(), triangles.end(), m_Tris);
 	for (uint32_t i = 0; i < m_NTris; ++i) m_TriIdx[i] = i;
 	BuildBVH();
 }
 
+dae::BVH::~BVH()
+{
+	if (m_RebuildThread.joinable()) m_RebuildThread.join();
+	delete m_pRebuiltBVH;
+
+	delete[] m_BvhNodes;
+	delete[] m_Tris;
+	delete[] m_TriIdx;
+}
+
 void dae::BVH::Update()
 {
+	if (m_Settings.splitMethod == BVHSplitMethod::LBVH)
+	{
+		//a Morton rebuild costs about as much as a refit and never degrades
+		UpdateTriangles();
+		BuildBVH();
+		UpdateLeafLayout();
+		UpdateLeafTriangles();
+		CollapseToWideBVH();
+		return;
+	}
+
+	const bool rebuilt{ FinishRebuild() };
+	if (rebuilt) UpdateLeafLayout();
+
 	UpdateTriangles();
 	RefitBVH();
+	UpdateLeafTriangles();
+	CollapseToWideBVH();
+
+	//the new tree was built for older vertices, its refit cost is the new baseline
+	if (rebuilt) m_BuildCost = m_Cost;
+
+	if (m_Settings.rebuildCostRatio > 0 && GetCostRatio() > m_Settings.rebuildCostRatio && !m_RebuildThread.joinable())
+		StartRebuild();
 }
 
 void dae::BVH::Intersect(const Ray& ray, const uint32_t nodeIdx, HitRecord& hitRecord, bool ignoreHitRecord)
@@ -51,27 +703,50 @@ void dae::BVH::Intersect(const Ray& ray, const uint32_t nodeIdx, HitRecord& hitR
 }
 
 void dae::BVH::IntersectBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
+{
+	switch (m_Settings.layout)
+	{
+	case BVHLayout::Wide4:
+		IntersectWideBVH<4>(ray, hitRecord, ignoreHitRecord);
+		break;
+	case BVHLayout::Wide8:
+		IntersectWideBVH<8>(ray, hitRecord, ignoreHitRecord);
+		break;
+	case BVHLayout::Binary:
+	default:
+		IntersectBinaryBVH(ray, hitRecord, ignoreHitRecord);
+		break;
+	}
+}
+
+void dae::BVH::IntersectBinaryBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
 {
 	BVHNode* node = &m_BvhNodes[m_RootNodeIdx], *stack[64];
 	uint32_t stackPtr{ 0 };
 
-	HitRecord tmp{};
+	const WideRay wideRay{ ray, GetTraversalCullMode(ignoreHitRecord) };
+	float closestT{ hitRecord.t };
+	uint32_t closestSlot{ UINT32_MAX };
 
 	//infinite loop completes when trying to pop from an empty stack
 	while (1) 
 	{
 		if (node->isLeaf())
 		{
-			for (uint32_t i = 0; i < node->triCount; i++)
+			const uint32_t firstBlock{ m_LeafFirstBlock[node - m_BvhNodes] };
+			const uint32_t blockCount{ (node->triCount + LeafBlockWidth - 1) / LeafBlockWidth };
+			for (uint32_t block = firstBlock; block < firstBlock + blockCount; ++block)
 			{
-				if (GeometryUtils::HitTest_Triangle(m_Tris[m_TriIdx[node->leftFirst + i]], ray, tmp, ignoreHitRecord))
+				uint32_t lane;
+				if (IntersectTriangleBlock(m_LeafBlocks[block], ray, wideRay, closestT, lane))
 				{
-					if (ignoreHitRecord) return;
-
-					if (tmp.t < hitRecord.t)
+					if (ignoreHitRecord)
 					{
-						hitRecord = tmp;
+						hitRecord.didHit = true;
+						return;
 					}
+
+					closestSlot = block * LeafBlockWidth + lane;
 				}
 			}
 
@@ -104,97 +779,512 @@ void dae::BVH::IntersectBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHit
 			if (dist2 != FLT_MAX) stack[stackPtr++] = child2;
 		}
 	}
-}
 
-float dae::BVH::IntersectAABB(const Vector3& bmin, const Vector3 bmax, const Ray& ray)
-{
-	float tx1 = (bmin.x - ray.origin.x) * ray.reciproke.x, tx2 = (bmax.x - ray.origin.x) * ray.reciproke.x;
-	float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
-	float ty1 = (bmin.y - ray.origin.y) * ray.reciproke.y, ty2 = (bmax.y - ray.origin.y) * ray.reciproke.y;
-	tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
-	float tz1 = (bmin.z - ray.origin.z) * ray.reciproke.z, tz2 = (bmax.z - ray.origin.z) * ray.reciproke.z;
-	tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
-	if ((tmax >= tmin && tmax > 0)) return tmin;
-	else return FLT_MAX;
+	if (closestSlot != UINT32_MAX) FillHitRecord(ray, closestSlot, closestT, hitRecord);
 }
 
-void dae::BVH::BuildBVH()
+template<uint32_t Width>
+void dae::BVH::IntersectWideBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
 {
-	BVHNode& root = m_BvhNodes[m_RootNodeIdx];
-	root.leftFirst = 0;
-	root.triCount = m_NTris;
+	const WideBVHNode<Width>* nodes{ nullptr };
+	if constexpr (Width == 4) nodes = m_WideNodes4.data();
+	else nodes = m_WideNodes8.data();
 
-	UpdateNodeBounds(m_RootNodeIdx);
-	Subdivide(m_RootNodeIdx);
-}
+	const WideRay wideRay{ ray, GetTraversalCullMode(ignoreHitRecord) };
 
-void dae::BVH::GenerateTriangles(const TriangleMesh& mesh)
-{
-	Triangle t{};
-	int normalIdx{ 0 };
-	int triIdx{ 0 };
-	for (uint32_t i = 0; i < mesh.indices.size(); i += 3)
+	//every pop pushes at most Width - 1 entries
+	struct StackEntry
 	{
-		const uint32_t v0 = mesh.indices[i];
-		const uint32_t v1 = mesh.indices[i + 1];
-		const uint32_t v2 = mesh.indices[i + 2];
-
-		t = {
-			mesh.transformedPositions[v0],
-			mesh.transformedPositions[v1],
-			mesh.transformedPositions[v2],
-			mesh.transformedNormals[normalIdx++]
-		};
-
-		t.cullMode = mesh.cullMode;
-		t.materialIndex = mesh.materialIndex;
+		uint32_t nodeIdx;
+		float dist;
+	};
+	StackEntry stack[64 * Width];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = { 0, 0.f };
 
-		t.centroid = (t.v0 + t.v1 + t.v2) * .333f;
-		
-		m_Tris[triIdx] = t;
-		++triIdx;
-	}
-}
+	float closestT{ hitRecord.t };
+	uint32_t closestSlot{ UINT32_MAX };
 
-void dae::BVH::UpdateTriangles()
-{
-	int normalIdx{ 0 };
-	int triIdx{ 0 };
-	for (uint32_t i = 0; i < m_Mesh.indices.size(); i += 3)
+	while (stackPtr > 0)
 	{
-		const uint32_t v0 = m_Mesh.indices[i];
-		const uint32_t v1 = m_Mesh.indices[i + 1];
-		const uint32_t v2 = m_Mesh.indices[i + 2];
+		const StackEntry entry{ stack[--stackPtr] };
 
-		m_Tris[triIdx].v0 =	m_Mesh.transformedPositions[v0];
-		m_Tris[triIdx].v1 =	m_Mesh.transformedPositions[v1];
-		m_Tris[triIdx].v2 =	m_Mesh.transformedPositions[v2];
-		m_Tris[triIdx].normal = m_Mesh.transformedNormals[normalIdx++];
-		m_Tris[triIdx].centroid = (m_Tris[triIdx].v0 + m_Tris[triIdx].v1 + m_Tris[triIdx].v2) * .333f;
-		++triIdx;
-	}
-}
+		//a closer hit was found since this node was pushed
+		if (entry.dist >= closestT) continue;
 
-void dae::BVH::UpdateNodeBounds(const uint32_t nodeIdx)
-{
-	BVHNode& node = m_BvhNodes[nodeIdx];
+		const WideBVHNode<Width>& node{ nodes[entry.nodeIdx] };
 
-	node.bounds.minAABB = { FLT_MAX, FLT_MAX, FLT_MAX };
-	node.bounds.maxAABB = { FLT_MIN, FLT_MIN, FLT_MIN };
+		float dist[Width];
+		uint32_t hitMask{ IntersectChildren(node, wideRay, closestT, dist) };
 
-	for (uint32_t first = node.leftFirst, i = 0; i < node.triCount; ++i) {
+		//sort the hit children front to back
+		uint32_t order[Width];
+		uint32_t numHits{ 0 };
+		while (hitMask)
+		{
+			const uint32_t child{ CountTrailingZeros(hitMask) };
+			hitMask &= hitMask - 1;
 
-		uint32_t leafTriIdx = m_TriIdx[first + i];
-		Triangle& leafTri = m_Tris[leafTriIdx];
+			uint32_t insertIdx{ numHits++ };
+			while (insertIdx > 0 && dist[order[insertIdx - 1]] > dist[child])
+			{
+				order[insertIdx] = order[insertIdx - 1];
+				--insertIdx;
+			}
+			order[insertIdx] = child;
+		}
 
-		node.bounds.minAABB = Vector3::Min(node.bounds.minAABB, leafTri.v0);
-		node.bounds.minAABB = Vector3::Min(node.bounds.minAABB, leafTri.v1);
-		node.bounds.minAABB = Vector3::Min(node.bounds.minAABB, leafTri.v2);
+		//leaves are tested right away, nearest first
+		for (uint32_t i = 0; i < numHits; ++i)
+		{
+			const uint32_t child{ order[i] };
+			if (node.triCount[child] == 0) continue;
 
-		node.bounds.maxAABB = Vector3::Max(node.bounds.maxAABB, leafTri.v0);
-		node.bounds.maxAABB = Vector3::Max(node.bounds.maxAABB, leafTri.v1);
-		node.bounds.maxAABB = Vector3::Max(node.bounds.maxAABB, leafTri.v2);
+			const uint32_t blockCount{ (node.triCount[child] + LeafBlockWidth - 1) / LeafBlockWidth };
+			for (uint32_t block = node.child[child]; block < node.child[child] + blockCount; ++block)
+			{
+				uint32_t lane;
+				if (IntersectTriangleBlock(m_LeafBlocks[block], ray, wideRay, closestT, lane))
+				{
+					if (ignoreHitRecord)
+					{
+						hitRecord.didHit = true;
+						return;
+					}
+
+					closestSlot = block * LeafBlockWidth + lane;
+				}
+			}
+		}
+
+		//interior children are pushed far to near so the nearest one is popped next
+		for (uint32_t i = numHits; i > 0; --i)
+		{
+			const uint32_t child{ order[i - 1] };
+			if (node.triCount[child] != 0) continue;
+
+			stack[stackPtr++] = { node.child[child], dist[child] };
+		}
+	}
+
+	if (closestSlot != UINT32_MAX) FillHitRecord(ray, closestSlot, closestT, hitRecord);
+}
+
+bool dae::BVH::DoesHit(const Ray& ray) const
+{
+	switch (m_Settings.layout)
+	{
+	case BVHLayout::Wide4:
+		return DoesHitWideBVH<4>(ray);
+	case BVHLayout::Wide8:
+		return DoesHitWideBVH<8>(ray);
+	case BVHLayout::Binary:
+	default:
+		return DoesHitBinaryBVH(ray);
+	}
+}
+
+bool dae::BVH::DoesHitBinaryBVH(const Ray& ray) const
+{
+	const WideRay wideRay{ ray, GetTraversalCullMode(false) };
+
+	uint32_t stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = m_RootNodeIdx;
+
+	while (stackPtr > 0)
+	{
+		const uint32_t nodeIdx{ stack[--stackPtr] };
+		const BVHNode& node = m_BvhNodes[nodeIdx];
+
+		const float dist{ IntersectAABB(node.bounds.minAABB, node.bounds.maxAABB, ray) };
+		if (dist == FLT_MAX || IsBeyondMax(dist, ray)) continue;
+
+		if (node.isLeaf())
+		{
+			const uint32_t firstBlock{ m_LeafFirstBlock[nodeIdx] };
+			const uint32_t blockCount{ (node.triCount + LeafBlockWidth - 1) / LeafBlockWidth };
+			for (uint32_t block = firstBlock; block < firstBlock + blockCount; ++block)
+			{
+				if (DoesHitTriangleBlock(m_LeafBlocks[block], ray, wideRay)) return true;
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = node.leftFirst + 1;
+		stack[stackPtr++] = node.leftFirst;
+	}
+
+	return false;
+}
+
+template<uint32_t Width>
+bool dae::BVH::DoesHitWideBVH(const Ray& ray) const
+{
+	const WideBVHNode<Width>* nodes{ nullptr };
+	if constexpr (Width == 4) nodes = m_WideNodes4.data();
+	else nodes = m_WideNodes8.data();
+
+	const WideRay wideRay{ ray, GetTraversalCullMode(false) };
+
+	//every pop pushes at most Width - 1 entries
+	uint32_t stack[64 * Width];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = 0;
+
+	while (stackPtr > 0)
+	{
+		const WideBVHNode<Width>& node{ nodes[stack[--stackPtr]] };
+
+		float dist[Width];
+		for (uint32_t hitMask{ IntersectChildren(node, wideRay, FLT_MAX, dist) }; hitMask; hitMask &= hitMask - 1)
+		{
+			const uint32_t child{ CountTrailingZeros(hitMask) };
+			if (IsBeyondMax(dist[child], ray)) continue;
+
+			if (node.triCount[child] == 0)
+			{
+				stack[stackPtr++] = node.child[child];
+				continue;
+			}
+
+			const uint32_t blockCount{ (node.triCount[child] + LeafBlockWidth - 1) / LeafBlockWidth };
+			for (uint32_t block = node.child[child]; block < node.child[child] + blockCount; ++block)
+			{
+				if (DoesHitTriangleBlock(m_LeafBlocks[block], ray, wideRay)) return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void dae::BVH::IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const
+{
+	alignas(32) float closestT[RayPacket::Size];
+	uint32_t closestSlot[RayPacket::Size];
+	for (uint32_t i = 0; i < RayPacket::Size; ++i)
+	{
+		closestT[i] = hitRecords[i].t;
+		closestSlot[i] = UINT32_MAX;
 	}
+
+	//one stack for the whole packet, every entry remembers which rays reached the node
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+
+	float entry;
+	const uint32_t rootMask{ packet.IntersectBounds(m_BvhNodes[m_RootNodeIdx].bounds, rayMask, closestT, entry) };
+	if (rootMask) stack[stackPtr++] = { m_RootNodeIdx, rootMask };
+
+	while (stackPtr > 0)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_BvhNodes[current.nodeIdx];
+
+		if (node.isLeaf())
+		{
+			IntersectLeafPacket(packet, current.rayMask, current.nodeIdx, closestT, closestSlot);
+			continue;
+		}
+
+		uint32_t child1{ node.leftFirst }, child2{ node.leftFirst + 1 };
+		float entry1, entry2;
+		uint32_t mask1{ packet.IntersectBounds(m_BvhNodes[child1].bounds, current.rayMask, closestT, entry1) };
+		uint32_t mask2{ packet.IntersectBounds(m_BvhNodes[child2].bounds, current.rayMask, closestT, entry2) };
+
+		if (entry1 > entry2)
+		{
+			std::swap(entry1, entry2);
+			std::swap(child1, child2);
+			std::swap(mask1, mask2);
+		}
+
+		//far child first, so the near one is popped next
+		if (mask2) stack[stackPtr++] = { child2, mask2 };
+		if (mask1) stack[stackPtr++] = { child1, mask1 };
+	}
+
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ CountTrailingZeros(mask) };
+		if (closestSlot[i] != UINT32_MAX) FillHitRecord(packet.GetRay(i), closestSlot[i], closestT[i], hitRecords[i]);
+	}
+}
+
+void dae::BVH::IntersectLeafPacket(const RayPacket& packet, uint32_t rayMask, uint32_t nodeIdx, float* closestT, uint32_t* closestSlot) const
+{
+	const TriangleCullMode cullMode{ GetTraversalCullMode(false) };
+	const uint32_t firstSlot{ m_LeafFirstBlock[nodeIdx] * LeafBlockWidth };
+
+	//the packet is wide already, so the block lanes are walked one triangle at a time
+	for (uint32_t i = 0; i < m_BvhNodes[nodeIdx].triCount; ++i)
+	{
+		const uint32_t slot{ firstSlot + i };
+		const TriangleBlock<LeafBlockWidth>& block = m_LeafBlocks[slot / LeafBlockWidth];
+		const uint32_t lane{ slot % LeafBlockWidth };
+
+		const PackedTriangle triangle{
+			{ block.v0X[lane], block.v0Y[lane], block.v0Z[lane] },
+			{ block.edge1X[lane], block.edge1Y[lane], block.edge1Z[lane] },
+			{ block.edge2X[lane], block.edge2Y[lane], block.edge2Z[lane] } };
+
+		IntersectTrianglePacket(triangle, cullMode, packet, rayMask, slot, closestT, closestSlot);
+	}
+}
+
+float dae::BVH::IntersectAABB(const Vector3& bmin, const Vector3 bmax, const Ray& ray) const
+{
+	float tx1 = (bmin.x - ray.origin.x) * ray.reciproke.x, tx2 = (bmax.x - ray.origin.x) * ray.reciproke.x;
+	float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+	float ty1 = (bmin.y - ray.origin.y) * ray.reciproke.y, ty2 = (bmax.y - ray.origin.y) * ray.reciproke.y;
+	tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+	float tz1 = (bmin.z - ray.origin.z) * ray.reciproke.z, tz2 = (bmax.z - ray.origin.z) * ray.reciproke.z;
+	tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+	if ((tmax >= tmin && tmax > 0)) return tmin;
+	else return FLT_MAX;
+}
+
+bool dae::BVH::IsParallelNode(uint32_t triCount) const
+{
+	return !m_SerialBuild && triCount >= ParallelNodeThreshold;
+}
+
+bool dae::BVH::IsParallelSubtree(uint32_t triCount) const
+{
+	return !m_SerialBuild && triCount >= ParallelSubtreeThreshold;
+}
+
+void dae::BVH::BuildBVH()
+{
+	//the tree can be built more than once
+	m_NodesUsed.store(m_RootNodeIdx + 1);
+
+	if (m_Settings.splitMethod == BVHSplitMethod::LBVH)
+	{
+		BuildLBVH();
+		return;
+	}
+
+	BVHNode& root = m_BvhNodes[m_RootNodeIdx];
+	root.leftFirst = 0;
+	root.triCount = m_NTris;
+
+	UpdateNodeBounds(m_RootNodeIdx);
+	Subdivide(m_RootNodeIdx);
+}
+
+void dae::BVH::BuildLBVH()
+{
+	const AABB centroidBounds{ !IsParallelNode(m_NTris)
+		? CalculateCentroidBounds(0, m_NTris)
+		: ParallelReduce<AABB>(0, m_NTris,
+			[this](uint32_t first, uint32_t count) { return CalculateCentroidBounds(first, count); },
+			[](AABB& result, const AABB& chunkBounds) { result.Grow(chunkBounds); }) };
+
+	//quantize every centroid to the 1024^3 grid over the centroid bounds
+	const Vector3 extent{ centroidBounds.maxAABB - centroidBounds.minAABB };
+	float scale[3]{};
+	for (int a = 0; a < 3; ++a)
+	{
+		scale[a] = extent[a] > 0 ? ((1u << MortonAxisBits) - 1) / extent[a] : 0;
+	}
+
+	//sort keys hold the Morton code in the upper and the triangle index in the lower half
+	std::vector<uint64_t>& keys{ m_MortonKeys };
+	keys.resize(m_NTris);
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	threadPool.ParallelFor(0, m_NTris, ParallelChunkSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const Vector3& centroid{ m_Tris[i].centroid };
+			uint32_t mortonCode{ 0 };
+			for (int a = 0; a < 3; ++a)
+			{
+				mortonCode |= SpreadBits3D(static_cast<uint32_t>((centroid[a] - centroidBounds.minAABB[a]) * scale[a])) << (2 - a);
+			}
+			keys[i] = static_cast<uint64_t>(mortonCode) << 32 | i;
+		}
+	});
+
+	SortMortonKeys(keys, m_SortedMortonKeys, m_RadixOffsets);
+
+	std::vector<uint32_t>& mortonCodes{ m_MortonCodes };
+	mortonCodes.resize(m_NTris);
+	threadPool.ParallelFor(0, m_NTris, ParallelChunkSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			mortonCodes[i] = static_cast<uint32_t>(keys[i] >> 32);
+			m_TriIdx[i] = static_cast<uint32_t>(keys[i]);
+		}
+	});
+
+	BVHNode& root = m_BvhNodes[m_RootNodeIdx];
+	root.leftFirst = 0;
+	root.triCount = m_NTris;
+	SubdivideLBVH(m_RootNodeIdx, mortonCodes.data());
+
+	//the splits only need the codes, all bounds are filled in bottom up afterwards
+	RefitBVH();
+}
+
+void dae::BVH::SubdivideLBVH(uint32_t nodeIdx, const uint32_t* mortonCodes)
+{
+	BVHNode& node = m_BvhNodes[nodeIdx];
+	if (node.triCount <= LBVHMaxLeafSize) return;
+
+	const uint32_t first{ node.leftFirst };
+	const uint32_t last{ node.leftFirst + node.triCount - 1 };
+
+	//split where the highest bit that differs in the range flips, identical codes are split in the middle
+	uint32_t split{ first + node.triCount / 2 };
+	if (mortonCodes[first] != mortonCodes[last])
+	{
+		const int commonPrefix{ std::countl_zero(mortonCodes[first] ^ mortonCodes[last]) };
+
+		//binary search for the last code that still shares more than the common prefix with the first one
+		uint32_t lastLeft{ first };
+		uint32_t step{ node.triCount - 1 };
+		do
+		{
+			step = (step + 1) >> 1;
+			const uint32_t candidate{ lastLeft + step };
+			if (candidate < last && std::countl_zero(mortonCodes[first] ^ mortonCodes[candidate]) > commonPrefix)
+				lastLeft = candidate;
+		} while (step > 1);
+
+		split = lastLeft + 1;
+	}
+
+	const uint32_t leftCount{ split - first };
+	const uint32_t leftChildIdx{ m_NodesUsed.fetch_add(2) };
+	const uint32_t rightChildIdx{ leftChildIdx + 1 };
+	m_BvhNodes[leftChildIdx].leftFirst = first;
+	m_BvhNodes[leftChildIdx].triCount = leftCount;
+	m_BvhNodes[rightChildIdx].leftFirst = split;
+	m_BvhNodes[rightChildIdx].triCount = node.triCount - leftCount;
+	node.leftFirst = leftChildIdx;
+	node.triCount = 0;
+
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	TaskGroup subtrees{};
+
+	if (IsParallelSubtree(m_BvhNodes[leftChildIdx].triCount))
+		threadPool.Submit(subtrees, [this, leftChildIdx, mortonCodes] { SubdivideLBVH(leftChildIdx, mortonCodes); });
+	else
+		SubdivideLBVH(leftChildIdx, mortonCodes);
+
+	SubdivideLBVH(rightChildIdx, mortonCodes);
+	threadPool.Wait(subtrees);
+}
+
+void dae::BVH::GenerateTriangles(const TriangleMesh& mesh)
+{
+	const std::vector<Vector3>& positions{ GetPositions(mesh) };
+	const std::vector<Vector3>& normals{ GetNormals(mesh) };
+
+	Triangle t{};
+	int normalIdx{ 0 };
+	int triIdx{ 0 };
+	for (uint32_t i = 0; i < mesh.indices.size(); i += 3)
+	{
+		const uint32_t v0 = mesh.indices[i];
+		const uint32_t v1 = mesh.indices[i + 1];
+		const uint32_t v2 = mesh.indices[i + 2];
+
+		t = {
+			positions[v0],
+			positions[v1],
+			positions[v2],
+			normals[normalIdx++]
+		};
+
+		t.cullMode = mesh.cullMode;
+		t.materialIndex = mesh.materialIndex;
+
+		t.centroid = (t.v0 + t.v1 + t.v2) * .333f;
+		
+		m_Tris[triIdx] = t;
+		++triIdx;
+	}
+}
+
+void dae::BVH::UpdateTriangles()
+{
+	const std::vector<Vector3>& positions{ GetPositions(m_Mesh) };
+	const std::vector<Vector3>& normals{ GetNormals(m_Mesh) };
+
+	//every triangle only reads its own three vertices, so chunks can be updated independently
+	ThreadPool::Get().ParallelFor(0, m_NTris, 1024, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t triIdx = begin; triIdx < end; ++triIdx)
+		{
+			const uint32_t v0 = m_Mesh.indices[triIdx * 3];
+			const uint32_t v1 = m_Mesh.indices[triIdx * 3 + 1];
+			const uint32_t v2 = m_Mesh.indices[triIdx * 3 + 2];
+
+			m_Tris[triIdx].v0 =	positions[v0];
+			m_Tris[triIdx].v1 =	positions[v1];
+			m_Tris[triIdx].v2 =	positions[v2];
+			m_Tris[triIdx].normal = normals[triIdx].Normalized(); //scaled meshes don't keep unit normals, builds normalize them in the Triangle constructor
+			m_Tris[triIdx].centroid = (m_Tris[triIdx].v0 + m_Tris[triIdx].v1 + m_Tris[triIdx].v2) * .333f;
+		}
+	});
+}
+
+void dae::BVH::UpdateNodeBounds(const uint32_t nodeIdx)
+{
+	BVHNode& node = m_BvhNodes[nodeIdx];
+
+	if (!IsParallelNode(node.triCount))
+	{
+		node.bounds = CalculateTriangleBounds(node.leftFirst, node.triCount);
+		return;
+	}
+
+	node.bounds = ParallelReduce<AABB>(node.leftFirst, node.triCount,
+		[this](uint32_t first, uint32_t count) { return CalculateTriangleBounds(first, count); },
+		[](AABB& result, const AABB& chunkBounds) { result.Grow(chunkBounds); });
+}
+
+dae::AABB dae::BVH::CalculateTriangleBounds(uint32_t first, uint32_t count) const
+{
+	AABB bounds{};
+
+	for (uint32_t i = 0; i < count; ++i) {
+
+		const Triangle& leafTri = m_Tris[m_TriIdx[first + i]];
+
+		bounds.minAABB = Vector3::Min(bounds.minAABB, leafTri.v0);
+		bounds.minAABB = Vector3::Min(bounds.minAABB, leafTri.v1);
+		bounds.minAABB = Vector3::Min(bounds.minAABB, leafTri.v2);
+
+		bounds.maxAABB = Vector3::Max(bounds.maxAABB, leafTri.v0);
+		bounds.maxAABB = Vector3::Max(bounds.maxAABB, leafTri.v1);
+		bounds.maxAABB = Vector3::Max(bounds.maxAABB, leafTri.v2);
+	}
+
+	return bounds;
+}
+
+dae::AABB dae::BVH::CalculateCentroidBounds(uint32_t first, uint32_t count) const
+{
+	AABB bounds{};
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		bounds.Grow(m_Tris[m_TriIdx[first + i]].centroid);
+	}
+
+	return bounds;
 }
 
 void dae::BVH::Subdivide(const uint32_t nodeIdx)
@@ -213,25 +1303,23 @@ void dae::BVH::Subdivide(const uint32_t nodeIdx)
 
 	int axis = -1;
 	float splitPos{ 0 };
-	float splitCost{ FindBestSplitPlane(node, axis, splitPos) };
+	const float splitCost{ FindBestSplitPlane(node, axis, splitPos) };
+
+	//only split when the traversal step and the children are cheaper than testing every triangle of this node
+	if (axis == -1 || BVHTraversalCost * node.bounds.area() + splitCost >= CalculateNodeCost(node)) return;
 
 	//split the group in two halves
-	int i = node.leftFirst;
-	int j = i + node.triCount - 1;
-	while (i <= j) {
-		if (m_Tris[m_TriIdx[i]].centroid[axis] < splitPos)
-			++i;
-		else
-			std::swap(m_TriIdx[i], m_TriIdx[j--]); //swap each primitive that is not on the left of the plane with a primitive at the end of the list.
-	}
+	const uint32_t i{ !IsParallelNode(node.triCount)
+		? Partition(node.leftFirst, node.triCount, axis, splitPos)
+		: PartitionParallel(node.leftFirst, node.triCount, axis, splitPos) };
 
 	//abort split if one of the sides is empty
-	int leftCount = i - node.leftFirst;
+	const uint32_t leftCount = i - node.leftFirst;
 	if (leftCount == 0 || leftCount == node.triCount) return; 
 
-	//create child nodes for each half
-	const uint32_t leftChildIdx{ m_NodesUsed++ };
-	const uint32_t rightChildIdx{ m_NodesUsed++ };
+	//create child nodes for each half, siblings are allocated together so they stay adjacent
+	const uint32_t leftChildIdx{ m_NodesUsed.fetch_add(2) };
+	const uint32_t rightChildIdx{ leftChildIdx + 1 };
 	m_BvhNodes[leftChildIdx].leftFirst = node.leftFirst;
 	m_BvhNodes[leftChildIdx].triCount = leftCount;
 	m_BvhNodes[rightChildIdx].leftFirst = i;
@@ -242,11 +1330,109 @@ void dae::BVH::Subdivide(const uint32_t nodeIdx)
 	UpdateNodeBounds(leftChildIdx);
 	UpdateNodeBounds(rightChildIdx);
 
-	Subdivide(leftChildIdx);
+	//the two halves are independent, so big ones are built by other threads
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	TaskGroup subtrees{};
+
+	if (IsParallelSubtree(m_BvhNodes[leftChildIdx].triCount))
+		threadPool.Submit(subtrees, [this, leftChildIdx] { Subdivide(leftChildIdx); });
+	else
+		Subdivide(leftChildIdx);
+
 	Subdivide(rightChildIdx);
+	threadPool.Wait(subtrees);
+}
+
+uint32_t dae::BVH::Partition(uint32_t first, uint32_t count, int axis, float splitPos)
+{
+	int i = first;
+	int j = i + count - 1;
+	while (i <= j) {
+		if (m_Tris[m_TriIdx[i]].centroid[axis] < splitPos)
+			++i;
+		else
+			std::swap(m_TriIdx[i], m_TriIdx[j--]); //swap each primitive that is not on the left of the plane with a primitive at the end of the list.
+	}
+	return i;
+}
+
+uint32_t dae::BVH::PartitionParallel(uint32_t first, uint32_t count, int axis, float splitPos)
+{
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	const uint32_t numChunks{ GetNumChunks(count) };
+
+	//count the left side of every chunk
+	std::vector<uint32_t> leftCounts(numChunks);
+	threadPool.ParallelFor(0, numChunks, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t chunkFirst{ first + chunk * ParallelChunkSize };
+			const uint32_t chunkEnd{ std::min(chunkFirst + ParallelChunkSize, first + count) };
+
+			uint32_t leftCount{ 0 };
+			for (uint32_t i = chunkFirst; i < chunkEnd; ++i)
+			{
+				if (m_Tris[m_TriIdx[i]].centroid[axis] < splitPos) ++leftCount;
+			}
+			leftCounts[chunk] = leftCount;
+		}
+	});
+
+	//prefix sums give every chunk its own write range on both sides
+	std::vector<uint32_t> leftOffsets(numChunks), rightOffsets(numChunks);
+	uint32_t totalLeft{ 0 };
+	for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+	{
+		leftOffsets[chunk] = totalLeft;
+		totalLeft += leftCounts[chunk];
+	}
+	for (uint32_t chunk = 0, rightOffset = totalLeft; chunk < numChunks; ++chunk)
+	{
+		rightOffsets[chunk] = rightOffset;
+		rightOffset += std::min(ParallelChunkSize, count - chunk * ParallelChunkSize) - leftCounts[chunk];
+	}
+
+	std::vector<uint32_t> partitioned(count);
+	threadPool.ParallelFor(0, numChunks, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t chunkFirst{ first + chunk * ParallelChunkSize };
+			const uint32_t chunkEnd{ std::min(chunkFirst + ParallelChunkSize, first + count) };
+
+			uint32_t leftIdx{ leftOffsets[chunk] }, rightIdx{ rightOffsets[chunk] };
+			for (uint32_t i = chunkFirst; i < chunkEnd; ++i)
+			{
+				if (m_Tris[m_TriIdx[i]].centroid[axis] < splitPos)
+					partitioned[leftIdx++] = m_TriIdx[i];
+				else
+					partitioned[rightIdx++] = m_TriIdx[i];
+			}
+		}
+	});
+
+	threadPool.ParallelFor(0, count, ParallelChunkSize, [&](uint32_t begin, uint32_t end)
+	{
+		std::copy(partitioned.begin() + begin, partitioned.begin() + end, m_TriIdx + first + begin);
+	});
+
+	return first + totalLeft;
 }
 
 float dae::BVH::FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos)
+{
+	switch (m_Settings.splitMethod)
+	{
+	case BVHSplitMethod::ExhaustiveSAH:
+		return FindBestSplitPlaneExhaustive(node, axis, splitPos);
+	case BVHSplitMethod::BinnedSAH:
+	default:
+		return FindBestSplitPlaneBinned(node, axis, splitPos);
+	}
+}
+
+float dae::BVH::FindBestSplitPlaneExhaustive(BVHNode& node, int& axis, float& splitPos)
 {
 	float bestCost{ FLT_MAX };
 	for (uint32_t a = 0; a < 3; a++) for (uint32_t i = 0; i < node.triCount; ++i)
@@ -264,28 +1450,604 @@ float dae::BVH::FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos)
 	return bestCost;
 }
 
+float dae::BVH::FindBestSplitPlaneBinned(BVHNode& node, int& axis, float& splitPos)
+{
+	const uint32_t binCount{ m_Settings.binCount };
+	const bool isParallel{ IsParallelNode(node.triCount) };
+
+	//bin over the centroid bounds, the triangle bounds would leave the outer bins empty
+	const AABB centroidBounds{ isParallel
+		? ParallelReduce<AABB>(node.leftFirst, node.triCount,
+			[this](uint32_t first, uint32_t count) { return CalculateCentroidBounds(first, count); },
+			[](AABB& result, const AABB& chunkBounds) { result.Grow(chunkBounds); })
+		: CalculateCentroidBounds(node.leftFirst, node.triCount) };
+
+	float scale[3]{};
+	for (int a = 0; a < 3; ++a)
+	{
+		const float extent{ centroidBounds.maxAABB[a] - centroidBounds.minAABB[a] };
+		scale[a] = extent > 0 ? binCount / extent : 0;
+	}
+
+	//fill the bins of all three axes in one pass over the triangles
+	const auto binTriangles = [&](uint32_t first, uint32_t count)
+	{
+		BinSet binSet{};
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const Triangle& t = m_Tris[m_TriIdx[first + i]];
+			for (int a = 0; a < 3; ++a)
+			{
+				const uint32_t binIdx{ std::min(binCount - 1, static_cast<uint32_t>((t.centroid[a] - centroidBounds.minAABB[a]) * scale[a])) };
+				Bin& bin = binSet.bins[a][binIdx];
+				++bin.triCount;
+				bin.bounds.Grow(t.v0);
+				bin.bounds.Grow(t.v1);
+				bin.bounds.Grow(t.v2);
+			}
+		}
+		return binSet;
+	};
+
+	const BinSet binSet{ isParallel
+		? ParallelReduce<BinSet>(node.leftFirst, node.triCount, binTriangles,
+			[binCount](BinSet& result, const BinSet& chunkBins)
+			{
+				for (int a = 0; a < 3; ++a) for (uint32_t b = 0; b < binCount; ++b)
+				{
+					result.bins[a][b].triCount += chunkBins.bins[a][b].triCount;
+					result.bins[a][b].bounds.Grow(chunkBins.bins[a][b].bounds);
+				}
+			})
+		: binTriangles(node.leftFirst, node.triCount) };
+
+	float bestCost{ FLT_MAX };
+	for (int a = 0; a < 3; ++a)
+	{
+		if (scale[a] == 0) continue;
+		const Bin* bins = binSet.bins[a];
+
+		//sweep from both sides to get the area and count on either side of every bin border
+		float leftArea[BVHBuildSettings::MaxBinCount - 1]{}, rightArea[BVHBuildSettings::MaxBinCount - 1]{};
+		uint32_t leftCount[BVHBuildSettings::MaxBinCount - 1]{}, rightCount[BVHBuildSettings::MaxBinCount - 1]{};
+		AABB leftBox{}, rightBox{};
+		uint32_t leftSum{ 0 }, rightSum{ 0 };
+		for (uint32_t i = 0; i < binCount - 1; ++i)
+		{
+			leftSum += bins[i].triCount;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].bounds);
+			leftArea[i] = leftBox.area();
+
+			rightSum += bins[binCount - 1 - i].triCount;
+			rightCount[binCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[binCount - 1 - i].bounds);
+			rightArea[binCount - 2 - i] = rightBox.area();
+		}
+
+		const float binWidth{ (centroidBounds.maxAABB[a] - centroidBounds.minAABB[a]) / binCount };
+		for (uint32_t i = 0; i < binCount - 1; ++i)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+			const float cost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
+			if (cost < bestCost)
+			{
+				axis = a;
+				splitPos = centroidBounds.minAABB[a] + binWidth * (i + 1);
+				bestCost = cost;
+			}
+		}
+	}
+	return bestCost;
+}
+
+float dae::BVH::CalculateNodeCost(const BVHNode& node) const
+{
+	return node.triCount * node.bounds.area();
+}
+
 void dae::BVH::RefitBVH()
 {
-	for (int i = m_NodesUsed - 1; i >= 0; i--) 
+	//relative to the root area, which makes it the expected cost of a ray entering the root
+	m_Cost = RefitNode(m_RootNodeIdx, 0) / m_BvhNodes[m_RootNodeIdx].bounds.area();
+}
+
+float dae::BVH::RefitNode(uint32_t nodeIdx, uint32_t depth)
+{
+	BVHNode& node = m_BvhNodes[nodeIdx];
+
+	if (node.isLeaf())
+	{
+		//adjust leaf node bounds to contained triangles
+		UpdateNodeBounds(nodeIdx);
+		return CalculateNodeCost(node);
+	}
+
+	//the top of big trees is split over the thread pool, every subtree only writes its own nodes
+	float leftCost{ 0 }, rightCost{ 0 };
+	if (IsParallelSubtree(m_NTris) && depth < ParallelRefitDepth)
+	{
+		ThreadPool& threadPool{ ThreadPool::Get() };
+		TaskGroup subtrees{};
+
+		threadPool.Submit(subtrees, [this, &node, &leftCost, depth] { leftCost = RefitNode(node.leftFirst, depth + 1); });
+		rightCost = RefitNode(node.leftFirst + 1, depth + 1);
+		threadPool.Wait(subtrees);
+	}
+	else
 	{
-		if (i != 1) 
+		leftCost = RefitNode(node.leftFirst, depth + 1);
+		rightCost = RefitNode(node.leftFirst + 1, depth + 1);
+	}
+
+	//adjust interior node to child node bounds
+	const BVHNode& leftChild = m_BvhNodes[node.leftFirst];
+	const BVHNode& rightChild = m_BvhNodes[node.leftFirst + 1];
+	node.bounds.minAABB = Vector3::Min(leftChild.bounds.minAABB, rightChild.bounds.minAABB);
+	node.bounds.maxAABB = Vector3::Max(leftChild.bounds.maxAABB, rightChild.bounds.maxAABB);
+
+	return BVHTraversalCost * node.bounds.area() + leftCost + rightCost;
+}
+
+float dae::BVH::CalculateCost(uint32_t nodeIdx) const
+{
+	//SAH with the same traversal cost as the builder, not divided by the root area yet
+	const BVHNode& node = m_BvhNodes[nodeIdx];
+	if (node.isLeaf()) return CalculateNodeCost(node);
+
+	return BVHTraversalCost * node.bounds.area() + CalculateCost(node.leftFirst) + CalculateCost(node.leftFirst + 1);
+}
+
+void dae::BVH::StartRebuild()
+{
+	//the thread builds over a snapshot, the vertices keep moving while it runs
+	BVHBuildSettings settings{ m_Settings };
+	settings.cacheDirectory.clear();
+	settings.rebuildCostRatio = 0;
+
+	std::vector<Triangle> triangles(m_Tris, m_Tris + m_NTris);
+
+	m_RebuildDone.store(false, std::memory_order_relaxed);
+	m_RebuildThread = std::thread([this, settings, triangles = std::move(triangles)]() mutable
 		{
-			BVHNode& node = m_BvhNodes[i];
+			m_pRebuiltBVH = new BVH(m_Mesh, settings, std::move(triangles));
+			m_RebuildDone.store(true, std::memory_order_release);
+		});
+}
+
+bool dae::BVH::FinishRebuild()
+{
+	if (!m_RebuildDone.load(std::memory_order_acquire)) return false;
+
+	m_RebuildThread.join();
+	m_RebuildDone.store(false, std::memory_order_relaxed);
 
-			if (node.isLeaf())
+	//only the topology is taken over, triangle i is the same triangle in both trees and the refit after this moves it to the current vertices
+	std::swap(m_BvhNodes, m_pRebuiltBVH->m_BvhNodes);
+	std::swap(m_TriIdx, m_pRebuiltBVH->m_TriIdx);
+	m_NodesUsed.store(m_pRebuiltBVH->m_NodesUsed.load());
+
+	delete m_pRebuiltBVH;
+	m_pRebuiltBVH = nullptr;
+	return true;
+}
+
+void dae::BVH::UpdateLeafLayout()
+{
+	const uint32_t nodesUsed{ m_NodesUsed.load() };
+	const uint32_t numChunks{ GetNumChunks(nodesUsed) };
+	m_LeafFirstBlock.resize(nodesUsed);
+	m_ChunkBlockOffsets.resize(numChunks);
+
+	//leaves get whole blocks so one leaf never shares a block with another
+	//every chunk of nodes numbers its blocks from 0, the chunk offsets are added once all chunks are counted
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	threadPool.ParallelFor(0, numChunks, 1, [this, nodesUsed](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t chunkEnd{ std::min((chunk + 1) * ParallelChunkSize, nodesUsed) };
+			uint32_t blockCount{ 0 };
+			for (uint32_t i = chunk * ParallelChunkSize; i < chunkEnd; ++i)
 			{
-				//adjust leaf node bounds to contained triangles
-				UpdateNodeBounds(i);
-				continue;
+				const BVHNode& node = m_BvhNodes[i];
+				if (!node.isLeaf()) continue;
+
+				m_LeafFirstBlock[i] = blockCount;
+				blockCount += (node.triCount + LeafBlockWidth - 1) / LeafBlockWidth;
 			}
+			m_ChunkBlockOffsets[chunk] = blockCount;
+		}
+	});
+
+	uint32_t blockCount{ 0 };
+	for (uint32_t& chunkOffset : m_ChunkBlockOffsets)
+	{
+		const uint32_t chunkBlockCount{ chunkOffset };
+		chunkOffset = blockCount;
+		blockCount += chunkBlockCount;
+	}
 
-			//adjust interior node to child node bounds
-			BVHNode& leftChild = m_BvhNodes[node.leftFirst];
-			BVHNode& rightChild = m_BvhNodes[node.leftFirst + 1];
-			node.bounds.minAABB = Vector3::Min(leftChild.bounds.minAABB, rightChild.bounds.minAABB);
-			node.bounds.maxAABB = Vector3::Max(leftChild.bounds.maxAABB, rightChild.bounds.maxAABB);
+	threadPool.ParallelFor(1, numChunks, 1, [this, nodesUsed](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t chunkEnd{ std::min((chunk + 1) * ParallelChunkSize, nodesUsed) };
+			for (uint32_t i = chunk * ParallelChunkSize; i < chunkEnd; ++i)
+			{
+				if (m_BvhNodes[i].isLeaf()) m_LeafFirstBlock[i] += m_ChunkBlockOffsets[chunk];
+			}
 		}
+	});
+
+	//not cleared: UpdateLeafTriangles writes every lane of a leaf's blocks, the padding included
+	m_LeafBlocks.resize(blockCount);
+	m_LeafShadingData.resize(blockCount * LeafBlockWidth);
+}
+
+void dae::BVH::UpdateLeafTriangles()
+{
+	//resolves the m_TriIdx indirection once instead of on every leaf visit
+	ThreadPool::Get().ParallelFor(0, m_NodesUsed.load(), ParallelChunkSize, [this](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t nodeIdx = begin; nodeIdx < end; ++nodeIdx)
+		{
+			const BVHNode& node = m_BvhNodes[nodeIdx];
+			if (!node.isLeaf()) continue;
+
+			const uint32_t firstSlot{ m_LeafFirstBlock[nodeIdx] * LeafBlockWidth };
+			const uint32_t slotCount{ (node.triCount + LeafBlockWidth - 1) / LeafBlockWidth * LeafBlockWidth };
+			for (uint32_t i = 0; i < slotCount; ++i)
+			{
+				//the padding lanes are zeroed: a zero determinant is rejected as parallel, so they are never hit
+				Vector3 v0{}, edge1{}, edge2{};
+				TriangleShadingData shadingData{};
+				if (i < node.triCount)
+				{
+					const Triangle& triangle = m_Tris[m_TriIdx[node.leftFirst + i]];
+					v0 = triangle.v0;
+					edge1 = triangle.v1 - triangle.v0;
+					edge2 = triangle.v2 - triangle.v0;
+					shadingData = { triangle.normal, triangle.materialIndex };
+				}
+
+				const uint32_t slot{ firstSlot + i };
+				TriangleBlock<LeafBlockWidth>& block = m_LeafBlocks[slot / LeafBlockWidth];
+				const uint32_t lane{ slot % LeafBlockWidth };
+				block.v0X[lane] = v0.x;
+				block.v0Y[lane] = v0.y;
+				block.v0Z[lane] = v0.z;
+				block.edge1X[lane] = edge1.x;
+				block.edge1Y[lane] = edge1.y;
+				block.edge1Z[lane] = edge1.z;
+				block.edge2X[lane] = edge2.x;
+				block.edge2Y[lane] = edge2.y;
+				block.edge2Z[lane] = edge2.z;
+
+				m_LeafShadingData[slot] = shadingData;
+			}
+		}
+	});
+}
+
+uint32_t dae::BVH::GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const
+{
+	//same cull mode as the single ray DoesHit, which traces its rays as regular ones
+	const TriangleCullMode cullMode{ GetTraversalCullMode(false) };
+
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = { m_RootNodeIdx, rayMask };
+
+	uint32_t occludedMask{ 0 };
+	float entry;
+
+	while (stackPtr > 0 && occludedMask != rayMask)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_BvhNodes[current.nodeIdx];
+
+		//the reversed rays only cull boxes, the triangles below see every ray in its own direction
+		const uint32_t nodeMask{ packet.reversed.IntersectBounds(node.bounds, current.rayMask & ~occludedMask, packet.length, entry) };
+		if (nodeMask == 0) continue;
+
+		if (node.isLeaf())
+		{
+			const uint32_t firstBlock{ m_LeafFirstBlock[current.nodeIdx] };
+			const uint32_t blockCount{ (node.triCount + LeafBlockWidth - 1) / LeafBlockWidth };
+
+			for (uint32_t mask = nodeMask; mask; mask &= mask - 1)
+			{
+				const uint32_t i{ CountTrailingZeros(mask) };
+				const Ray& ray = packet.rays[i];
+				const WideRay wideRay{ ray, cullMode };
+
+				for (uint32_t block = firstBlock; block < firstBlock + blockCount; ++block)
+				{
+					if (DoesHitTriangleBlock(m_LeafBlocks[block], ray, wideRay))
+					{
+						occludedMask |= 1u << i;
+						break;
+					}
+				}
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = { node.leftFirst + 1, nodeMask };
+		stack[stackPtr++] = { node.leftFirst, nodeMask };
+	}
+
+	return occludedMask;
+}
+
+void dae::BVH::FillHitRecord(const Ray& ray, uint32_t leafSlot, float t, HitRecord& hitRecord) const
+{
+	const TriangleShadingData& shadingData = m_LeafShadingData[leafSlot];
+
+	hitRecord.didHit = true;
+	hitRecord.materialIndex = shadingData.materialIndex;
+	hitRecord.normal = shadingData.normal;
+	hitRecord.origin = ray.origin + ray.direction * t;
+	hitRecord.t = t;
+}
+
+dae::TriangleCullMode dae::BVH::GetTraversalCullMode(bool ignoreHitRecord) const
+{
+	//shadow rays flip the cull mode, same as GeometryUtils::HitTest_Triangle
+	const TriangleCullMode cullMode{ m_Mesh.cullMode };
+	return ignoreHitRecord ? static_cast<TriangleCullMode>((static_cast<int>(cullMode) + 1) % 2) : cullMode;
+}
+
+void dae::BVH::CollapseToWideBVH()
+{
+	switch (m_Settings.layout)
+	{
+	case BVHLayout::Wide4:
+		CollapseTree<4>(m_WideNodes4, m_SubtreeNodes4);
+		break;
+	case BVHLayout::Wide8:
+		CollapseTree<8>(m_WideNodes8, m_SubtreeNodes8);
+		break;
+	case BVHLayout::Binary:
+	default:
+		break;
+	}
+}
+
+template<uint32_t Width>
+void dae::BVH::CollapseTree(std::vector<WideBVHNode<Width>>& wideNodes, std::vector<std::vector<WideBVHNode<Width>>>& subtreeNodes)
+{
+	//the top levels are collapsed here, the subtrees below them by the thread pool into arrays of their own
+	//appending those arrays costs a copy of the subtrees, which only pays off with more than one thread
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	const bool isParallel{ IsParallelSubtree(m_NTris) && threadPool.GetNumThreads() > 1 };
+
+	wideNodes.clear();
+	m_CollapseSubtrees.clear();
+	CollapseNode<Width>(m_RootNodeIdx, wideNodes, 0, isParallel ? ParallelCollapseDepth : UINT32_MAX);
+
+	const uint32_t numSubtrees{ static_cast<uint32_t>(m_CollapseSubtrees.size()) };
+	if (numSubtrees == 0) return;
+
+	//the arrays are kept between updates, clear keeps their capacity
+	if (subtreeNodes.size() < numSubtrees) subtreeNodes.resize(numSubtrees);
+	threadPool.ParallelFor(0, numSubtrees, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			subtreeNodes[i].clear();
+			CollapseNode<Width>(m_CollapseSubtrees[i].nodeIdx, subtreeNodes[i], 0, UINT32_MAX);
+		}
+	});
+
+	//append the subtrees behind the top levels, their root is their first node
+	uint32_t wideNodeCount{ static_cast<uint32_t>(wideNodes.size()) };
+	for (uint32_t i = 0; i < numSubtrees; ++i)
+	{
+		const CollapseSubtree& subtree{ m_CollapseSubtrees[i] };
+		wideNodes[subtree.parentWideIdx].child[subtree.parentLane] = wideNodeCount;
+		wideNodeCount += static_cast<uint32_t>(subtreeNodes[i].size());
 	}
+	wideNodes.resize(wideNodeCount);
+
+	threadPool.ParallelFor(0, numSubtrees, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const CollapseSubtree& subtree{ m_CollapseSubtrees[i] };
+			const uint32_t firstWideIdx{ wideNodes[subtree.parentWideIdx].child[subtree.parentLane] };
+			for (uint32_t localIdx = 0; localIdx < subtreeNodes[i].size(); ++localIdx)
+			{
+				WideBVHNode<Width>& wideNode{ wideNodes[firstWideIdx + localIdx] };
+				wideNode = subtreeNodes[i][localIdx];
+
+				//interior children were numbered within the subtree
+				for (uint32_t lane = 0; lane < wideNode.childCount; ++lane)
+				{
+					if (wideNode.triCount[lane] == 0) wideNode.child[lane] += firstWideIdx;
+				}
+			}
+		}
+	});
+}
+
+template<uint32_t Width>
+uint32_t dae::BVH::CollapseNode(uint32_t nodeIdx, std::vector<WideBVHNode<Width>>& wideNodes, uint32_t depth, uint32_t subtreeDepth)
+{
+	const uint32_t wideIdx{ static_cast<uint32_t>(wideNodes.size()) };
+	wideNodes.emplace_back();
+
+	const BVHNode& node = m_BvhNodes[nodeIdx];
+	uint32_t children[Width]{};
+	uint32_t childCount{ 0 };
+
+	if (node.isLeaf())
+	{
+		children[childCount++] = nodeIdx;
+	}
+	else
+	{
+		children[childCount++] = node.leftFirst;
+		children[childCount++] = node.leftFirst + 1;
+	}
+
+	//pull grandchildren up by opening the biggest interior child until the node is full, big boxes get hit most
+	while (childCount < Width)
+	{
+		int openIdx{ -1 };
+		float openArea{ -FLT_MAX };
+		for (uint32_t i = 0; i < childCount; ++i)
+		{
+			const BVHNode& child = m_BvhNodes[children[i]];
+			if (!child.isLeaf() && child.bounds.area() > openArea)
+			{
+				openIdx = static_cast<int>(i);
+				openArea = child.bounds.area();
+			}
+		}
+		if (openIdx == -1) break;
+
+		const uint32_t firstGrandChild{ m_BvhNodes[children[openIdx]].leftFirst };
+		children[openIdx] = firstGrandChild;
+		children[childCount++] = firstGrandChild + 1;
+	}
+
+	WideBVHNode<Width> wideNode{};
+	wideNode.childCount = childCount;
+	for (uint32_t i = 0; i < childCount; ++i)
+	{
+		const BVHNode& child = m_BvhNodes[children[i]];
+		wideNode.minX[i] = child.bounds.minAABB.x;
+		wideNode.minY[i] = child.bounds.minAABB.y;
+		wideNode.minZ[i] = child.bounds.minAABB.z;
+		wideNode.maxX[i] = child.bounds.maxAABB.x;
+		wideNode.maxY[i] = child.bounds.maxAABB.y;
+		wideNode.maxZ[i] = child.bounds.maxAABB.z;
+
+		wideNode.triCount[i] = child.triCount;
+		if (child.isLeaf())
+			wideNode.child[i] = m_LeafFirstBlock[children[i]];
+		else if (depth + 1 < subtreeDepth)
+			wideNode.child[i] = CollapseNode(children[i], wideNodes, depth + 1, subtreeDepth);
+		else
+			m_CollapseSubtrees.push_back({ children[i], wideIdx, i }); //linked by CollapseTree once it is collapsed
+	}
+
+	//the recursion may have reallocated the vector, so write the node back by index
+	wideNodes[wideIdx] = wideNode;
+	return wideIdx;
+}
+
+uint64_t dae::BVH::CalculateCacheKey(const TriangleMesh& mesh) const
+{
+	//everything that ends up in the triangles or changes the shape of the tree
+	const std::vector<Vector3>& positions{ GetPositions(mesh) };
+	const std::vector<Vector3>& normals{ GetNormals(mesh) };
+
+	uint64_t hash{ HashBytes(&CacheVersion, sizeof(CacheVersion)) };
+	hash = HashBytes(positions.data(), positions.size() * sizeof(Vector3), hash);
+	hash = HashBytes(normals.data(), normals.size() * sizeof(Vector3), hash);
+	hash = HashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(int), hash);
+	hash = HashBytes(&mesh.cullMode, sizeof(mesh.cullMode), hash);
+	hash = HashBytes(&mesh.materialIndex, sizeof(mesh.materialIndex), hash);
+	hash = HashBytes(&m_Settings.splitMethod, sizeof(m_Settings.splitMethod), hash);
+	hash = HashBytes(&m_Settings.binCount, sizeof(m_Settings.binCount), hash);
+	return hash;
+}
+
+const std::vector<dae::Vector3>& dae::BVH::GetPositions(const TriangleMesh& mesh) const
+{
+	return m_Settings.objectSpace ? mesh.positions : mesh.transformedPositions;
+}
+
+const std::vector<dae::Vector3>& dae::BVH::GetNormals(const TriangleMesh& mesh) const
+{
+	return m_Settings.objectSpace ? mesh.normals : mesh.transformedNormals;
+}
+
+std::string dae::BVH::GetCacheFilename(uint64_t cacheKey) const
+{
+	char keyString[17]{};
+	snprintf(keyString, sizeof(keyString), "%016llx", static_cast<unsigned long long>(cacheKey));
+	return (std::filesystem::path(m_Settings.cacheDirectory) / (std::string(keyString) + ".bvh")).string();
+}
+
+bool dae::BVH::LoadFromCache(uint64_t cacheKey)
+{
+	const MappedFile file{ GetCacheFilename(cacheKey) };
+	if (!file.IsValid() || file.GetSize() < sizeof(CacheHeader)) return false;
+
+	CacheHeader header{};
+	std::memcpy(&header, file.GetData(), sizeof(CacheHeader));
+
+	if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0
+		|| header.version != CacheVersion
+		|| header.cacheKey != cacheKey
+		|| header.nodeSize != sizeof(BVHNode)
+		|| header.triangleSize != sizeof(Triangle)
+		|| header.numTris != m_NTris
+		|| header.nodesUsed == 0 || header.nodesUsed > m_NTris * 2 - 1)
+		return false;
+
+	const size_t nodesSize{ header.nodesUsed * sizeof(BVHNode) };
+	const size_t triIdxSize{ m_NTris * sizeof(uint32_t) };
+	const size_t trisSize{ m_NTris * sizeof(Triangle) };
+	if (file.GetSize() != sizeof(CacheHeader) + nodesSize + triIdxSize + trisSize) return false;
+
+	//the arrays are stored exactly as they live in memory, loading is a straight copy out of the mapping
+	const uint8_t* pData = file.GetData() + sizeof(CacheHeader);
+	std::memcpy(m_BvhNodes, pData, nodesSize);
+	std::memcpy(m_TriIdx, pData + nodesSize, triIdxSize);
+	std::memcpy(m_Tris, pData + nodesSize + triIdxSize, trisSize);
+	m_NodesUsed = header.nodesUsed;
+
+	return true;
+}
+
+void dae::BVH::SaveToCache(uint64_t cacheKey) const
+{
+	std::error_code error{};
+	std::filesystem::create_directories(m_Settings.cacheDirectory, error);
+	if (error) return;
+
+	CacheHeader header{};
+	std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = CacheVersion;
+	header.cacheKey = cacheKey;
+	header.nodeSize = sizeof(BVHNode);
+	header.triangleSize = sizeof(Triangle);
+	header.numTris = m_NTris;
+	header.nodesUsed = m_NodesUsed;
+
+	//write next to the final file and rename, so a crash never leaves a truncated cache entry behind
+	const std::string filename{ GetCacheFilename(cacheKey) };
+	const std::string tempFilename{ filename + ".tmp" };
+	{
+		std::ofstream file{ tempFilename, std::ios::binary | std::ios::trunc };
+		if (!file) return;
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+		file.write(reinterpret_cast<const char*>(m_BvhNodes), header.nodesUsed * sizeof(BVHNode));
+		file.write(reinterpret_cast<const char*>(m_TriIdx), m_NTris * sizeof(uint32_t));
+		file.write(reinterpret_cast<const char*>(m_Tris), m_NTris * sizeof(Triangle));
+
+		if (!file)
+		{
+			std::cerr << "Failed to write BVH cache " << tempFilename << "\n";
+			return;
+		}
+	}
+
+	std::filesystem::rename(tempFilename, filename, error);
+	if (error) std::filesystem::remove(tempFilename, error);
 }
 
 float dae::BVH::EvaluateSAH(BVHNode& node, int axis, float pos)
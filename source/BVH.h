@@ -1,42 +1,196 @@
 #pragma once
 
 #include "DataTypes.h"
+#include "SIMD.h"
+#include <atomic>
+#include <string>
+#include <thread>
 
 namespace dae {
 
+	struct RayPacket;
+	struct ShadowRayPacket;
+
+	enum class BVHSplitMethod
+	{
+		ExhaustiveSAH, //every triangle centroid is a candidate plane, reference quality but quadratic per node
+		BinnedSAH, //candidate planes on the borders of equally sized centroid bins, linear per node
+		LBVH //centroids sorted along a Morton curve and split where the codes differ, cheap enough to rebuild every Update
+	};
+
+	enum class BVHLayout
+	{
+		Binary, //two children per node, scalar box tests
+		Wide4, //binary tree collapsed to 4 children per node, tested with SSE
+		Wide8 //binary tree collapsed to 8 children per node, tested with AVX
+	};
+
+	struct BVHBuildSettings
+	{
+		BVHSplitMethod splitMethod{ BVHSplitMethod::BinnedSAH };
+		BVHLayout layout{ SIMD::NativeWidth >= 8 ? BVHLayout::Wide8 : BVHLayout::Wide4 };
+		uint32_t binCount{ 16 };
+
+		//Refits whose SAH cost grows past this multiple of the freshly built cost start a background rebuild, 0 disables it
+		float rebuildCostRatio{ 1.5f };
+
+		//Build over the untransformed positions, the tree is then only traced through Instances placing it in the world
+		bool objectSpace{ false };
+
+		//Built trees are stored here keyed by a hash of the mesh and the settings above, opt-in since files are never evicted
+		//Only worth it for static meshes that are expensive to build, empty disables the cache
+		std::string cacheDirectory{};
+
+		static constexpr uint32_t MaxBinCount{ 64 };
+	};
+
 	class BVH
 	{
 	public:
-		BVH(TriangleMesh& mesh);
+		BVH(TriangleMesh& mesh, const BVHBuildSettings& settings = {});
+		~BVH();
 
+		BVH(const BVH&) = delete;
+		BVH(BVH&&) noexcept = delete;
+		BVH& operator=(const BVH&) = delete;
+		BVH& operator=(BVH&&) noexcept = delete;
+
+		//Refits the tree to the moved vertices, swaps in a finished background rebuild first
 		void Update();
 
 		void Intersect(const Ray& ray, const uint32_t nodeIdx, HitRecord& hitRecord, bool ignoreHitRecord = false);
 		void IntersectBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false);
-		float IntersectAABB(const Vector3& bmin, const Vector3 bmax, const Ray& ray);
+		void IntersectBinaryBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false);
+		template<uint32_t Width>
+		void IntersectWideBVH(const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false);
+		float IntersectAABB(const Vector3& bmin, const Vector3 bmax, const Ray& ray) const;
+
+		//Occlusion test with the cull mode IntersectBVH uses for regular rays, ends at the first triangle hit within [ray.min, ray.max]
+		//Children aren't sorted and no hit record is written
+		bool DoesHit(const Ray& ray) const;
+
+		//Traces the rays in rayMask together through the binary tree, hitRecords holds one record per packet slot and only gets closer hits
+		void IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const;
+		//Any hit test of the shadow rays in rayMask, returns the mask of the rays hitting a triangle
+		uint32_t GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const;
 		uint32_t GetRootNodeIdx() const { return m_RootNodeIdx; };
+		const AABB& GetBounds() const { return m_BvhNodes[m_RootNodeIdx].bounds; }
+		bool IsObjectSpace() const { return m_Settings.objectSpace; }
+
+		//SAH cost of the current tree relative to the cost it had right after it was built
+		float GetCostRatio() const { return m_Cost / m_BuildCost; }
+
+		//Leaf triangles are tested this many at a time, one AVX or SSE register per component
+		static constexpr uint32_t LeafBlockWidth{ SIMD::NativeWidth >= 8 ? 8u : 4u };
 	private:
+		//Builds a tree over a snapshot of another BVH's triangles, used for background rebuilds
+		BVH(TriangleMesh& mesh, const BVHBuildSettings& settings, std::vector<Triangle>&& triangles);
+
+		//Whether a node or subtree of this size is worth splitting over the thread pool, never for serial builds
+		bool IsParallelNode(uint32_t triCount) const;
+		bool IsParallelSubtree(uint32_t triCount) const;
+
 		void BuildBVH();
+		void BuildLBVH();
+		void SubdivideLBVH(uint32_t nodeIdx, const uint32_t* mortonCodes);
 		void GenerateTriangles(const TriangleMesh& mesh);
 		void UpdateNodeBounds(const uint32_t nodeIdx);
+		AABB CalculateTriangleBounds(uint32_t first, uint32_t count) const;
+		AABB CalculateCentroidBounds(uint32_t first, uint32_t count) const;
 		void Subdivide(const uint32_t nodeIdx);
+		uint32_t Partition(uint32_t first, uint32_t count, int axis, float splitPos);
+		uint32_t PartitionParallel(uint32_t first, uint32_t count, int axis, float splitPos);
 
 		float FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos);
+		float FindBestSplitPlaneExhaustive(BVHNode& node, int& axis, float& splitPos);
+		float FindBestSplitPlaneBinned(BVHNode& node, int& axis, float& splitPos);
+		float CalculateNodeCost(const BVHNode& node) const;
 
 		void UpdateTriangles();
 		void RefitBVH();
+		float RefitNode(uint32_t nodeIdx, uint32_t depth);
+		float CalculateCost(uint32_t nodeIdx) const;
+
+		void StartRebuild();
+		bool FinishRebuild();
+
+		//Hands every leaf its own run of triangle blocks, only needed when the topology changes
+		void UpdateLeafLayout();
+		//Copies the triangles into their leaf blocks: the hot blocks hold what the hit tests read, the cold array what a hit needs
+		void UpdateLeafTriangles();
+		bool DoesHitBinaryBVH(const Ray& ray) const;
+		template<uint32_t Width>
+		bool DoesHitWideBVH(const Ray& ray) const;
+
+		void FillHitRecord(const Ray& ray, uint32_t leafSlot, float t, HitRecord& hitRecord) const;
+		void IntersectLeafPacket(const RayPacket& packet, uint32_t rayMask, uint32_t nodeIdx, float* closestT, uint32_t* closestSlot) const;
+		TriangleCullMode GetTraversalCullMode(bool ignoreHitRecord) const;
+
+		//Subtree below the levels CollapseTree collapses itself, collapsed by its own task and linked into lane parentLane of parentWideIdx
+		struct CollapseSubtree
+		{
+			uint32_t nodeIdx{};
+			uint32_t parentWideIdx{};
+			uint32_t parentLane{};
+		};
+
+		void CollapseToWideBVH();
+		template<uint32_t Width>
+		void CollapseTree(std::vector<WideBVHNode<Width>>& wideNodes, std::vector<std::vector<WideBVHNode<Width>>>& subtreeNodes);
+		//Interior children at subtreeDepth are not collapsed but added to m_CollapseSubtrees
+		template<uint32_t Width>
+		uint32_t CollapseNode(uint32_t nodeIdx, std::vector<WideBVHNode<Width>>& wideNodes, uint32_t depth, uint32_t subtreeDepth);
+
+		const std::vector<Vector3>& GetPositions(const TriangleMesh& mesh) const;
+		const std::vector<Vector3>& GetNormals(const TriangleMesh& mesh) const;
+
+		uint64_t CalculateCacheKey(const TriangleMesh& mesh) const;
+		std::string GetCacheFilename(uint64_t cacheKey) const;
+		bool LoadFromCache(uint64_t cacheKey);
+		void SaveToCache(uint64_t cacheKey) const;
 
 		float EvaluateSAH(BVHNode& node, int axis, float pos);
 
+		BVHBuildSettings m_Settings{};
+
 		BVHNode* m_BvhNodes{};
 		uint32_t m_RootNodeIdx{ 0 };
-		uint32_t m_NodesUsed{ 1 };
+		std::atomic<uint32_t> m_NodesUsed{ 1 }; //subtrees are built by concurrent tasks
+
+		std::vector<TriangleBlock<LeafBlockWidth>> m_LeafBlocks{};
+		std::vector<TriangleShadingData> m_LeafShadingData{}; //one per block lane, indexed by block * LeafBlockWidth + lane
+		std::vector<uint32_t> m_LeafFirstBlock{}; //per node, only set for leaves
+
+		std::vector<WideBVHNode<4>> m_WideNodes4{};
+		std::vector<WideBVHNode<8>> m_WideNodes8{};
+
+		//Scratch of the per-frame rebuilds, kept as members so LBVH updates reuse their memory instead of allocating it again
+		std::vector<uint64_t> m_MortonKeys{};
+		std::vector<uint64_t> m_SortedMortonKeys{};
+		std::vector<uint32_t> m_RadixOffsets{};
+		std::vector<uint32_t> m_MortonCodes{};
+		std::vector<uint32_t> m_ChunkBlockOffsets{};
+		std::vector<CollapseSubtree> m_CollapseSubtrees{};
+		std::vector<std::vector<WideBVHNode<4>>> m_SubtreeNodes4{};
+		std::vector<std::vector<WideBVHNode<8>>> m_SubtreeNodes8{};
 
 		TriangleMesh& m_Mesh;
 		Triangle* m_Tris{};
 		uint32_t* m_TriIdx{};
 
-		uint32_t m_NTris;
+		uint32_t m_NTris{};
+
+		float m_BuildCost{ 1.f };
+		float m_Cost{ 1.f };
+
+		//Set for background rebuilds: tasks submitted from the rebuild thread land in the queue the frame threads drain while they wait,
+		//so a rebuild stalls the frame unless it stays on its own thread
+		bool m_SerialBuild{ false };
+
+		//written by the rebuild thread, swapped in by Update once m_RebuildDone is set
+		std::thread m_RebuildThread{};
+		BVH* m_pRebuiltBVH{};
+		std::atomic<bool> m_RebuildDone{ false };
 	};
 
 
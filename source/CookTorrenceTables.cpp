@@ -0,0 +1,99 @@
+#include "CookTorrenceTables.h"
+#include "BRDFs.h"
+
+#include <algorithm>
+
+using namespace dae;
+
+namespace
+{
+	//Unit vector at cosAngle to the z axis, its dot product with (0, 0, 1) is exactly cosAngle
+	Vector3 FromCosAngle(float cosAngle)
+	{
+		return { std::sqrt(std::max(1.f - cosAngle * cosAngle, 0.f)), 0.f, cosAngle };
+	}
+
+	//Schlick-GGX divided by cosAngle, BRDF::GeometryFunction_SchlickGGX without the 0 / 0 at grazing angles
+	float GetSchlickGGXOverCosAngle(float cosAngle, float roughness)
+	{
+		const float k{ ((roughness + 1) * (roughness + 1)) / 8.0f };
+		return 1.f / (cosAngle * (1 - k) + k);
+	}
+
+	//Splits a coordinate in [0, 1] into the sample before it and the weight of the sample after it
+	void GetSample(float coordinate, uint32_t resolution, uint32_t& index, float& weight)
+	{
+		const float position{ std::clamp(coordinate, 0.f, 1.f) * (resolution - 1) };
+		index = std::min(static_cast<uint32_t>(position), resolution - 2);
+		weight = position - index;
+	}
+}
+
+DistributionTable::DistributionTable()
+{
+	m_Values.resize(AngleResolution * RoughnessResolution);
+
+	const Vector3 normal{ 0.f, 0.f, 1.f };
+	for (uint32_t row{ 0 }; row < RoughnessResolution; ++row)
+	{
+		const float roughness{ static_cast<float>(row) / (RoughnessResolution - 1) };
+		for (uint32_t i{ 0 }; i < AngleResolution; ++i)
+		{
+			const float u{ static_cast<float>(i) / (AngleResolution - 1) };
+			//the materials pass the squared roughness, as in CookTorrenceMaterial::Shade
+			m_Values[i + row * AngleResolution] = BRDF::NormalDistribution_GGX(normal, FromCosAngle(1.f - u * u), roughness * roughness);
+		}
+	}
+}
+
+const DistributionTable& DistributionTable::Get()
+{
+	static const DistributionTable table{};
+	return table;
+}
+
+DistributionTable::Row DistributionTable::GetRow(float roughness)
+{
+	Row row{};
+	GetSample(roughness, RoughnessResolution, row.index, row.weight);
+	return row;
+}
+
+float DistributionTable::Lookup(float nh, const Row& row) const
+{
+	uint32_t i{};
+	float weight{};
+	GetSample(std::sqrt(1.f - std::clamp(nh, 0.f, 1.f)), AngleResolution, i, weight);
+
+	const float* pRow0{ &m_Values[i + row.index * AngleResolution] };
+	const float* pRow1{ pRow0 + AngleResolution };
+	return Lerpf(Lerpf(pRow0[0], pRow0[1], weight), Lerpf(pRow1[0], pRow1[1], weight), row.weight);
+}
+
+GeometryTable::GeometryTable(float roughness)
+{
+	m_Values.resize(Resolution * Resolution);
+
+	//the materials pass the squared roughness, as in CookTorrenceMaterial::Shade
+	const float sqrtRoughness{ roughness * roughness };
+	for (uint32_t y{ 0 }; y < Resolution; ++y)
+	{
+		const float light{ GetSchlickGGXOverCosAngle(static_cast<float>(y) / (Resolution - 1), sqrtRoughness) };
+		for (uint32_t x{ 0 }; x < Resolution; ++x)
+		{
+			m_Values[x + y * Resolution] = light * GetSchlickGGXOverCosAngle(static_cast<float>(x) / (Resolution - 1), sqrtRoughness);
+		}
+	}
+}
+
+float GeometryTable::Lookup(float nv, float nl) const
+{
+	uint32_t x{}, y{};
+	float weightX{}, weightY{};
+	GetSample(nv, Resolution, x, weightX);
+	GetSample(nl, Resolution, y, weightY);
+
+	const float* pRow0{ &m_Values[x + y * Resolution] };
+	const float* pRow1{ pRow0 + Resolution };
+	return Lerpf(Lerpf(pRow0[0], pRow0[1], weightX), Lerpf(pRow1[0], pRow1[1], weightX), weightY);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	//Sampled Cook-Torrance terms, looked up by CookTorrenceMaterial instead of being evaluated when a ShadingBatch asks for it
+	//Values between the samples are interpolated bilinearly
+	//Against exact shading the tables stay within 1% relative down to roughness 0.1 (SelfTest checks it),
+	//smoother materials lose accuracy on the GGX peak
+
+	//GGX normal distribution over (N.H, roughness), one table shared by all materials
+	//The N.H axis is sampled in sqrt(1 - N.H), which spreads the samples over the narrow peak of smooth materials
+	//Both axes need this many samples for 1%: D scales with roughness^4, so rows of smooth materials differ a lot (2 MB in total)
+	class DistributionTable final
+	{
+	public:
+		static constexpr uint32_t AngleResolution{ 2048 };
+		static constexpr uint32_t RoughnessResolution{ 256 };
+
+		//Position of a roughness on the roughness axis, materials compute theirs once
+		struct Row
+		{
+			uint32_t index{ 0 };
+			float weight{ 0.f };
+		};
+
+		~DistributionTable() = default;
+
+		DistributionTable(const DistributionTable&) = delete;
+		DistributionTable(DistributionTable&&) noexcept = delete;
+		DistributionTable& operator=(const DistributionTable&) = delete;
+		DistributionTable& operator=(DistributionTable&&) noexcept = delete;
+
+		//Built on first use
+		static const DistributionTable& Get();
+		static Row GetRow(float roughness);
+
+		float Lookup(float nh, const Row& row) const;
+
+	private:
+		DistributionTable();
+
+		std::vector<float> m_Values{};
+	};
+
+	//Smith geometry term divided by N.V * N.L, over (N.V, N.L) for the roughness of one material
+	//The term itself rises steeply from 0 at grazing angles, the quotient stays smooth there and interpolates without the error
+	//the division by N.V * N.L would magnify
+	class GeometryTable final
+	{
+	public:
+		static constexpr uint32_t Resolution{ 64 };
+
+		explicit GeometryTable(float roughness);
+		~GeometryTable() = default;
+
+		GeometryTable(const GeometryTable&) = delete;
+		GeometryTable(GeometryTable&&) noexcept = delete;
+		GeometryTable& operator=(const GeometryTable&) = delete;
+		GeometryTable& operator=(GeometryTable&&) noexcept = delete;
+
+		float Lookup(float nv, float nl) const;
+
+	private:
+		std::vector<float> m_Values{};
+	};
+}
@@ -2,10 +2,13 @@
 #include <cassert>
 #include <iostream>
 #include "Math.h"
+#include "ThreadPool.h"
 #include "vector"
 
 namespace dae
 {
+	class BVH;
+
 #pragma region GEOMETRY
 
 	struct Sphere
@@ -66,16 +69,38 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Triangle as the BVH leaves test it, the two edges leaving v0 are precomputed
+	//Stored per axis in TriangleBlocks, this is one lane of such a block
+	struct PackedTriangle
+	{
+		Vector3 v0{};
+		Vector3 edge1{};
+		Vector3 edge2{};
+	};
+
+	//Triangle data that is only read once the closest hit is known
+	struct TriangleShadingData
+	{
+		Vector3 normal{};
+		unsigned char materialIndex{};
+	};
+
 	struct AABB 
 	{
-		Vector3 minAABB;
-		Vector3 maxAABB;
+		//starts out empty (inverted) so the first Grow snaps it to the point
+		Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
 		void Grow(const Vector3& to) 
 		{
 			minAABB = Vector3::Min(minAABB, to);
 			maxAABB = Vector3::Max(maxAABB, to);
 		}
-		float area()
+		void Grow(const AABB& other)
+		{
+			minAABB = Vector3::Min(minAABB, other.minAABB);
+			maxAABB = Vector3::Max(maxAABB, other.maxAABB);
+		}
+		float area() const
 		{
 			Vector3 extent = maxAABB - minAABB;
 			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
@@ -86,7 +111,32 @@ namespace dae
 	{
 		AABB bounds{};
 		uint32_t leftFirst{}, triCount{};
-		bool isLeaf() { return triCount > 0; };
+		bool isLeaf() const { return triCount > 0; };
+	};
+
+	//SAH cost of a traversal step through a BVHNode, in units of one primitive test (a triangle, an object in the TLAS)
+	//Builders split a node only when this step plus its children costs less than the leaf, the refit cost uses the same model
+	constexpr float BVHTraversalCost{ 1.f };
+
+	//Collapsed BVH node with up to Width children, bounds are stored per axis (SoA) so one SIMD test checks every child
+	template<uint32_t Width>
+	struct alignas(32) WideBVHNode
+	{
+		float minX[Width], minY[Width], minZ[Width];
+		float maxX[Width], maxY[Width], maxZ[Width];
+
+		uint32_t child[Width]; //wide node index for interior children, first triangle block for leaves
+		uint32_t triCount[Width]; //0 for interior children
+		uint32_t childCount; //children are packed at the front
+	};
+
+	//Width leaf triangles stored per axis (SoA) so one SIMD test checks all of them, unused lanes are degenerate and never hit
+	template<uint32_t Width>
+	struct alignas(32) TriangleBlock
+	{
+		float v0X[Width], v0Y[Width], v0Z[Width];
+		float edge1X[Width], edge1Y[Width], edge1Z[Width];
+		float edge2X[Width], edge2Y[Width], edge2Z[Width];
 	};
 
 	struct TriangleMesh
@@ -128,6 +178,18 @@ namespace dae
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
 
+		//Transformed faces with their edges precomputed, one per face, what the mesh hit tests read
+		//Left empty while pBVH is set, the tree keeps its own copy of the faces
+		std::vector<PackedTriangle> packedTriangles{};
+
+		//Tree the scene traces this mesh through instead of its faces, set by Scene::UpdateTLAS for large meshes
+		BVH* pBVH{ nullptr };
+		//Set by UpdateTransforms, cleared once the scene refitted pBVH to the new positions
+		bool transformsChanged{ false };
+
+		//Vertices per chunk when UpdateTransforms splits a mesh over the thread pool
+		static constexpr uint32_t ParallelTransformGrainSize{ 1u << 13 };
+
 		/*
 		void GenerateBoundaryVolumeHierarchy()
 		{
@@ -392,27 +454,48 @@ namespace dae
 			//Calculate Final Transform 
 			const auto finalTransform = scaleTransform * rotationTransform * translationTransform;
 
-			transformedPositions.clear();
-			transformedNormals.clear();
-			transformedPositions.reserve(positions.size());
-			transformedNormals.reserve(normals.size());
+			//only reallocates when vertices were appended, every element is overwritten below
+			transformedPositions.resize(positions.size());
+			transformedNormals.resize(normals.size());
 
-			//Transform Positions (positions > transformedPositions)
-			//...
-			for (unsigned int i = 0; i < positions.size(); ++i)
+			//Transform Positions (positions > transformedPositions) and Normals (normals > transformedNormals)
+			const auto transformRange = [&](uint32_t begin, uint32_t end)
 			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(positions[i]));
-			}
+				if (begin < positions.size())
+				{
+					const size_t count{ std::min<size_t>(end, positions.size()) - begin };
+					finalTransform.TransformPoints(std::span{ positions }.subspan(begin, count), std::span{ transformedPositions }.subspan(begin, count));
+				}
+				if (begin < normals.size())
+				{
+					const size_t count{ std::min<size_t>(end, normals.size()) - begin };
+					finalTransform.TransformVectors(std::span{ normals }.subspan(begin, count), std::span{ transformedNormals }.subspan(begin, count));
+				}
+			};
+
+			//large meshes are split over the pool, for small ones handing out the work costs more than it saves
+			const uint32_t numTransforms{ static_cast<uint32_t>(std::max(positions.size(), normals.size())) };
+			if (numTransforms > ParallelTransformGrainSize)
+				ThreadPool::Get().ParallelFor(0, numTransforms, ParallelTransformGrainSize, transformRange);
+			else
+				transformRange(0, numTransforms);
 
+			UpdateTransformedAABB(finalTransform);
+			UpdatePackedTriangles();
+			transformsChanged = true;
+		}
 
-			//Transform Normals (normals > transformedNormals)
-			//...
-			for (unsigned int i = 0; i < normals.size(); ++i)
+		void UpdatePackedTriangles()
+		{
+			packedTriangles.clear();
+			if (pBVH) return;
+
+			packedTriangles.reserve(indices.size() / 3);
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
 			{
-				transformedNormals.emplace_back(finalTransform.TransformVector(normals[i]));
+				const Vector3& v0{ transformedPositions[indices[i]] };
+				packedTriangles.push_back({ v0, transformedPositions[indices[i + 1]] - v0, transformedPositions[indices[i + 2]] - v0 });
 			}
-
-			UpdateTransformedAABB(finalTransform);
 		}
 
 		void UpdateAABB()
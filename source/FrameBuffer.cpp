@@ -0,0 +1,79 @@
+//External includes
+#include "SDL.h"
+#include "SDL_surface.h"
+
+//Project includes
+#include "FrameBuffer.h"
+
+//Standard includes
+#include <new>
+
+using namespace dae;
+
+namespace
+{
+	//Row starts and tile edges line up with cache lines when the width is a multiple of 16
+	constexpr std::align_val_t PixelAlignment{ 64 };
+
+	SDL_Surface* CreateAlignedSurface(int width, int height)
+	{
+		void* pPixels = ::operator new[](static_cast<size_t>(width) * height * sizeof(uint32_t), PixelAlignment);
+		SDL_Surface* pSurface = SDL_CreateRGBSurfaceWithFormatFrom(pPixels, width, height, 32, width * static_cast<int>(sizeof(uint32_t)), SDL_PIXELFORMAT_ARGB8888);
+
+		//the surface only borrows the pixels, without one nothing else would free them
+		if (!pSurface) ::operator delete[](pPixels, PixelAlignment);
+		return pSurface;
+	}
+}
+
+#pragma region FrameBuffer
+FrameBuffer::FrameBuffer(SDL_Surface* pSurface) :
+	m_pSurface(pSurface)
+{
+	if (!m_pSurface) return;
+
+	m_Width = m_pSurface->w;
+	m_Height = m_pSurface->h;
+	m_pPixels = static_cast<uint32_t*>(m_pSurface->pixels);
+}
+
+uint32_t FrameBuffer::MapRGB(uint8_t r, uint8_t g, uint8_t b) const
+{
+	return SDL_MapRGB(m_pSurface->format, r, g, b);
+}
+
+int FrameBuffer::SaveToImage(const std::string& filename) const
+{
+	return SDL_SaveBMP(m_pSurface, filename.c_str());
+}
+#pragma endregion
+
+#pragma region WindowFrameBuffer
+WindowFrameBuffer::WindowFrameBuffer(SDL_Window* pWindow) :
+	FrameBuffer(SDL_GetWindowSurface(pWindow)),
+	m_pWindow(pWindow)
+{
+}
+
+void WindowFrameBuffer::Present()
+{
+	SDL_UpdateWindowSurface(m_pWindow);
+}
+#pragma endregion
+
+#pragma region OffscreenFrameBuffer
+OffscreenFrameBuffer::OffscreenFrameBuffer(int width, int height) :
+	FrameBuffer(CreateAlignedSurface(width, height))
+{
+}
+
+OffscreenFrameBuffer::~OffscreenFrameBuffer()
+{
+	//surfaces created from user memory don't free their pixels
+	SDL_FreeSurface(m_pSurface);
+	m_pSurface = nullptr;
+
+	::operator delete[](m_pPixels, PixelAlignment);
+	m_pPixels = nullptr;
+}
+#pragma endregion
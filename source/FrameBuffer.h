@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct SDL_Window;
+struct SDL_Surface;
+
+namespace dae
+{
+	//Pixel target the Renderer writes into
+	//Backed by an SDL_Surface, either owned by a window or allocated offscreen
+	class FrameBuffer
+	{
+	public:
+		virtual ~FrameBuffer() = default;
+
+		FrameBuffer(const FrameBuffer&) = delete;
+		FrameBuffer(FrameBuffer&&) noexcept = delete;
+		FrameBuffer& operator=(const FrameBuffer&) = delete;
+		FrameBuffer& operator=(FrameBuffer&&) noexcept = delete;
+
+		//False when the surface could not be created, nothing may be rendered into it then
+		bool IsValid() const { return m_pSurface != nullptr; }
+
+		uint32_t* GetPixels() const { return m_pPixels; }
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
+
+		uint32_t MapRGB(uint8_t r, uint8_t g, uint8_t b) const;
+
+		//Makes the rendered frame visible, no-op when there is nothing to show it on
+		virtual void Present() {}
+
+		/**
+		 * \brief Writes the current contents to a BMP file
+		 * \param filename path of the image to write
+		 * \return SDL_SaveBMP result (0 on success)
+		 */
+		int SaveToImage(const std::string& filename) const;
+
+	protected:
+		explicit FrameBuffer(SDL_Surface* pSurface);
+
+		SDL_Surface* m_pSurface{};
+		uint32_t* m_pPixels{};
+
+		int m_Width{};
+		int m_Height{};
+	};
+
+	//Renders into the surface of an SDL_Window and presents it on screen
+	class WindowFrameBuffer final : public FrameBuffer
+	{
+	public:
+		explicit WindowFrameBuffer(SDL_Window* pWindow);
+		~WindowFrameBuffer() override = default;
+
+		WindowFrameBuffer(const WindowFrameBuffer&) = delete;
+		WindowFrameBuffer(WindowFrameBuffer&&) noexcept = delete;
+		WindowFrameBuffer& operator=(const WindowFrameBuffer&) = delete;
+		WindowFrameBuffer& operator=(WindowFrameBuffer&&) noexcept = delete;
+
+		void Present() override;
+
+	private:
+		SDL_Window* m_pWindow{};
+	};
+
+	//Renders straight to memory, does not need a display or SDL video
+	class OffscreenFrameBuffer final : public FrameBuffer
+	{
+	public:
+		OffscreenFrameBuffer(int width, int height);
+		~OffscreenFrameBuffer() override;
+
+		OffscreenFrameBuffer(const OffscreenFrameBuffer&) = delete;
+		OffscreenFrameBuffer(OffscreenFrameBuffer&&) noexcept = delete;
+		OffscreenFrameBuffer& operator=(const OffscreenFrameBuffer&) = delete;
+		OffscreenFrameBuffer& operator=(OffscreenFrameBuffer&&) noexcept = delete;
+	};
+}
@@ -0,0 +1,136 @@
+#include "Instance.h"
+#include "BVH.h"
+#include "RayPacket.h"
+#include <bit>
+#include <cmath>
+
+dae::Instance::Instance(BVH* pBVH, const Matrix& transform) :
+	m_pBVH{ pBVH }
+{
+	SetTransform(transform);
+}
+
+void dae::Instance::SetTransform(const Matrix& transform)
+{
+	m_Transform = transform;
+	m_InverseTransform = Matrix::Inverse(transform);
+	m_NormalTransform = Matrix::Transpose(m_InverseTransform);
+	m_DirectionScale = std::abs(Vector3::Dot(transform.GetAxisX(), Vector3::Cross(transform.GetAxisY(), transform.GetAxisZ())));
+
+	//bound the 8 transformed corners of the object space bounds
+	const AABB& objectBounds{ m_pBVH->GetBounds() };
+	m_Bounds = {};
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		m_Bounds.Grow(m_Transform.TransformPoint(
+			corner & 1 ? objectBounds.maxAABB.x : objectBounds.minAABB.x,
+			corner & 2 ? objectBounds.maxAABB.y : objectBounds.minAABB.y,
+			corner & 4 ? objectBounds.maxAABB.z : objectBounds.minAABB.z));
+	}
+}
+
+bool dae::Instance::Intersect(const Ray& ray, HitRecord& hitRecord) const
+{
+	//d . (Ma x Mb) = det(M) (M^-1 d) . (a x b), so scaling the object space direction by |det| keeps the triangle determinants
+	//at their world space values and the parallel cutoff culls what it would on a transformed copy of the mesh
+	//distances along the ray shrink by the same factor
+	Ray objectRay{};
+	objectRay.origin = m_InverseTransform.TransformPoint(ray.origin);
+	objectRay.direction = m_InverseTransform.TransformVector(ray.direction) * m_DirectionScale;
+	const float scale{ 1 / m_DirectionScale };
+	objectRay.reciproke = { 1 / objectRay.direction.x, 1 / objectRay.direction.y, 1 / objectRay.direction.z };
+	objectRay.min = ray.min * scale;
+	objectRay.max = ray.max * scale * scale; //squared distance
+
+	HitRecord objectHit{};
+	objectHit.t = hitRecord.t * scale;
+	m_pBVH->IntersectBVH(objectRay, objectHit);
+	if (!objectHit.didHit) return false;
+
+	hitRecord.didHit = true;
+	hitRecord.materialIndex = objectHit.materialIndex;
+	hitRecord.t = objectHit.t / scale;
+	hitRecord.origin = ray.origin + ray.direction * hitRecord.t;
+	hitRecord.normal = m_NormalTransform.TransformVector(objectHit.normal).Normalized();
+
+	return true;
+}
+
+void dae::Instance::IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const
+{
+	RayPacket objectPacket{};
+	objectPacket.origin = m_InverseTransform.TransformPoint(packet.origin);
+	objectPacket.rayMask = rayMask;
+
+	//same per ray setup as Intersect
+	const float scale{ 1 / m_DirectionScale };
+	HitRecord objectHits[RayPacket::Size]{};
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+		Ray objectRay{};
+		objectRay.direction = m_InverseTransform.TransformVector({ packet.directionX[i], packet.directionY[i], packet.directionZ[i] }) * m_DirectionScale;
+		objectRay.reciproke = { 1 / objectRay.direction.x, 1 / objectRay.direction.y, 1 / objectRay.direction.z };
+		objectRay.min = packet.min[i] * scale;
+		objectRay.max = packet.max[i] * scale * scale;
+		objectPacket.SetRay(i, objectRay);
+
+		objectHits[i].t = hitRecords[i].t * scale;
+	}
+	objectPacket.UpdateIntervals();
+
+	m_pBVH->IntersectPacket(objectPacket, rayMask, objectHits);
+
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+		if (!objectHits[i].didHit) continue;
+
+		HitRecord& hitRecord = hitRecords[i];
+		hitRecord.didHit = true;
+		hitRecord.materialIndex = objectHits[i].materialIndex;
+		hitRecord.t = objectHits[i].t / scale;
+		hitRecord.origin = packet.origin + Vector3{ packet.directionX[i], packet.directionY[i], packet.directionZ[i] } * hitRecord.t;
+		hitRecord.normal = m_NormalTransform.TransformVector(objectHits[i].normal).Normalized();
+	}
+}
+
+bool dae::Instance::DoesHit(const Ray& ray) const
+{
+	//same object space ray as Intersect
+	Ray objectRay{};
+	objectRay.origin = m_InverseTransform.TransformPoint(ray.origin);
+	objectRay.direction = m_InverseTransform.TransformVector(ray.direction) * m_DirectionScale;
+	const float scale{ 1 / m_DirectionScale };
+	objectRay.reciproke = { 1 / objectRay.direction.x, 1 / objectRay.direction.y, 1 / objectRay.direction.z };
+	objectRay.min = ray.min * scale;
+	objectRay.max = ray.max * scale * scale;
+
+	return m_pBVH->DoesHit(objectRay);
+}
+
+uint32_t dae::Instance::GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const
+{
+	ShadowRayPacket objectPacket{};
+	objectPacket.SetEndpoint(m_InverseTransform.TransformPoint(packet.reversed.origin));
+
+	//same per ray setup as Intersect
+	const float scale{ 1 / m_DirectionScale };
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+		const Ray& ray = packet.rays[i];
+
+		Ray objectRay{};
+		objectRay.origin = m_InverseTransform.TransformPoint(ray.origin);
+		objectRay.direction = m_InverseTransform.TransformVector(ray.direction) * m_DirectionScale;
+		objectRay.reciproke = { 1 / objectRay.direction.x, 1 / objectRay.direction.y, 1 / objectRay.direction.z };
+		objectRay.min = ray.min * scale;
+		objectRay.max = ray.max * scale * scale;
+		objectPacket.SetRay(i, objectRay);
+	}
+	objectPacket.reversed.UpdateIntervals();
+
+	return m_pBVH->GetOccludedMask(objectPacket, rayMask);
+}
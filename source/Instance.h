@@ -0,0 +1,43 @@
+#pragma once
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	class BVH;
+	struct RayPacket;
+	struct ShadowRayPacket;
+
+	//Places an object space BVH in the world without touching its triangles
+	//Rays are moved into object space instead, so rigid motion only costs a matrix update and one BVH can be placed many times
+	class Instance final
+	{
+	public:
+		explicit Instance(BVH* pBVH, const Matrix& transform = {});
+
+		void SetTransform(const Matrix& transform);
+		const Matrix& GetTransform() const { return m_Transform; }
+
+		//World space bounds of the transformed BVH root
+		const AABB& GetBounds() const { return m_Bounds; }
+
+		//Only updates hitRecord when the instance is hit closer than hitRecord.t
+		bool Intersect(const Ray& ray, HitRecord& hitRecord) const;
+		//Occlusion test through BVH::DoesHit, no hit record is transformed back
+		bool DoesHit(const Ray& ray) const;
+		//Intersect for the rays in rayMask, the packet stays a packet in object space since its rays keep sharing one origin
+		void IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const;
+		//Any hit test of the shadow rays in rayMask, their shared endpoint stays shared in object space
+		uint32_t GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const;
+
+	private:
+		BVH* m_pBVH{};
+
+		Matrix m_Transform{};
+		Matrix m_InverseTransform{};
+		Matrix m_NormalTransform{}; //inverse transpose, keeps normals perpendicular under non-uniform scale
+		float m_DirectionScale{}; //|determinant| of m_Transform, object space directions are scaled by it
+
+		AABB m_Bounds{};
+	};
+}
@@ -2,14 +2,264 @@
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "CookTorrenceTables.h"
+#include <deque>
+#include <vector>
 
 namespace dae
 {
+	enum class MaterialType : uint8_t
+	{
+		SolidColor,
+		Lambert,
+		LambertPhong,
+		CookTorrence
+	};
+
+#pragma region Material BATCH
+	//Shading points sharing one material, stored per component (SoA) so the batch BRDFs load SIMD::NativeWidth of them at once
+	//Lanes past size are still evaluated, their results are ignored
+	struct alignas(32) ShadingBatch
+	{
+		static constexpr uint32_t MaxSize{ 256 };
+		static_assert(MaxSize % SIMD::NativeWidth == 0);
+
+		float normalX[MaxSize]{}, normalY[MaxSize]{}, normalZ[MaxSize]{};
+		float lightX[MaxSize]{}, lightY[MaxSize]{}, lightZ[MaxSize]{};
+		float viewX[MaxSize]{}, viewY[MaxSize]{}, viewZ[MaxSize]{};
+
+		uint32_t size{ 0 };
+
+		//Materials with lookup tables shade with them instead of evaluating their terms
+		bool useLookupTables{ false };
+
+		//Returns the slot of the point, its color ends up in the same slot of the ShadingResults
+		uint32_t Add(const Vector3& normal, const Vector3& l, const Vector3& v)
+		{
+			normalX[size] = normal.x; normalY[size] = normal.y; normalZ[size] = normal.z;
+			lightX[size] = l.x; lightY[size] = l.y; lightZ[size] = l.z;
+			viewX[size] = v.x; viewY[size] = v.y; viewZ[size] = v.z;
+			return size++;
+		}
+
+		BRDF::Wide::Vector3N GetNormals(uint32_t i) const { return { SIMD::Load(normalX + i), SIMD::Load(normalY + i), SIMD::Load(normalZ + i) }; }
+		BRDF::Wide::Vector3N GetDirectionsToLight(uint32_t i) const { return { SIMD::Load(lightX + i), SIMD::Load(lightY + i), SIMD::Load(lightZ + i) }; }
+		BRDF::Wide::Vector3N GetViewDirections(uint32_t i) const { return { SIMD::Load(viewX + i), SIMD::Load(viewY + i), SIMD::Load(viewZ + i) }; }
+	};
+
+	struct alignas(32) ShadingResults
+	{
+		float r[ShadingBatch::MaxSize]{}, g[ShadingBatch::MaxSize]{}, b[ShadingBatch::MaxSize]{};
+
+		void Set(uint32_t i, const BRDF::Wide::ColorN& color)
+		{
+			SIMD::Store(r + i, color.r);
+			SIMD::Store(g + i, color.g);
+			SIMD::Store(b + i, color.b);
+		}
+
+		ColorRGB Get(uint32_t i) const { return { r[i], g[i], b[i] }; }
+	};
+#pragma endregion
+
+#pragma region Material PARAMETERS
+	//Parameters of every material type together with its BRDF, stored by value in the MaterialTable
+	//Shade isn't virtual: callers always know the type they hold
+
+	//SOLID COLOR
+	//===========
+	struct SolidColorMaterial
+	{
+		ColorRGB color{ colors::White };
+
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			return color;
+		}
+
+		void Shade(const ShadingBatch& batch, ShadingResults& results) const
+		{
+			const BRDF::Wide::ColorN colorN{ BRDF::Wide::Broadcast(color) };
+			for (uint32_t i{ 0 }; i < batch.size; i += SIMD::NativeWidth) results.Set(i, colorN);
+		}
+	};
+
+	//LAMBERT
+	//=======
+	struct LambertMaterial
+	{
+		ColorRGB diffuseColor{ colors::White };
+		float diffuseReflectance{ 1.f }; //kd
+
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			return BRDF::Lambert(diffuseReflectance, diffuseColor);
+		}
+
+		void Shade(const ShadingBatch& batch, ShadingResults& results) const
+		{
+			const BRDF::Wide::ColorN diffuse{ BRDF::Wide::Broadcast(BRDF::Lambert(diffuseReflectance, diffuseColor)) };
+			for (uint32_t i{ 0 }; i < batch.size; i += SIMD::NativeWidth) results.Set(i, diffuse);
+		}
+	};
+
+	//LAMBERT-PHONG
+	//=============
+	struct LambertPhongMaterial
+	{
+		ColorRGB diffuseColor{ colors::White };
+		float diffuseReflectance{ 0.5f }; //kd
+		float specularReflectance{ 0.5f }; //ks
+		float phongExponent{ 1.f }; //Phong Exponent
+
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			return BRDF::Lambert(diffuseReflectance, diffuseColor)
+				+ BRDF::Phong(specularReflectance, phongExponent, l, -v, hitRecord.normal);
+		}
+
+		void Shade(const ShadingBatch& batch, ShadingResults& results) const
+		{
+			using namespace BRDF::Wide;
+			const ColorN diffuse{ Broadcast(BRDF::Lambert(diffuseReflectance, diffuseColor)) };
+
+			for (uint32_t i{ 0 }; i < batch.size; i += SIMD::NativeWidth)
+			{
+				const Vector3N n{ batch.GetNormals(i) };
+				const Vector3N l{ batch.GetDirectionsToLight(i) };
+				const Vector3N v{ batch.GetViewDirections(i) };
+
+				const FloatN specular{ Phong(specularReflectance, phongExponent, l, Vector3N{} - v, n) };
+				results.Set(i, { diffuse.r + specular, diffuse.g + specular, diffuse.b + specular });
+			}
+		}
+	};
+
+	//COOK TORRENCE
+	//=============
+	struct CookTorrenceMaterial
+	{
+		ColorRGB albedo{ 0.955f, 0.637f, 0.538f }; //Copper
+		float metalness{ 1.0f };
+		float roughness{ 0.1f }; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+
+		//Baked from the parameters above by Precompute, the MaterialTable runs it when the material is added
+		ColorRGB F0{};
+		float sqrtRoughness{};
+		DistributionTable::Row distributionRow{};
+		const GeometryTable* pGeometryTable{ nullptr };
+
+		void Precompute()
+		{
+			F0 = (metalness == 0) ? ColorRGB{ .04f, .04f, .04f } : albedo;
+			sqrtRoughness = roughness * roughness;
+			distributionRow = DistributionTable::GetRow(roughness);
+		}
+
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			const Vector3 halfVector{ (v + l).Normalized() };
+
+			const float normalDistribution{ BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, sqrtRoughness) };
+			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(halfVector, v, F0) };
+			const float geometryFunction{ BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, sqrtRoughness) };
+
+			ColorRGB specular{ (normalDistribution * fresnel * geometryFunction) };
+			specular /= (4 * Vector3::Dot(v, hitRecord.normal) * Vector3::Dot(hitRecord.normal, l));
+
+			ColorRGB kd{};
+			(metalness == 0)
+				? kd = ColorRGB(1, 1, 1) - fresnel
+				: kd = ColorRGB(0, 0, 0);
+
+			const ColorRGB diffuse{ BRDF::Lambert(kd, albedo) };
+
+			return diffuse + specular;
+		}
+
+		void Shade(const ShadingBatch& batch, ShadingResults& results) const
+		{
+			if (batch.useLookupTables && pGeometryTable)
+			{
+				ShadeWithTables(batch, results);
+				return;
+			}
+
+			using namespace BRDF::Wide;
+			for (uint32_t i{ 0 }; i < batch.size; i += SIMD::NativeWidth)
+			{
+				const Vector3N n{ batch.GetNormals(i) };
+				const Vector3N l{ batch.GetDirectionsToLight(i) };
+				const Vector3N v{ batch.GetViewDirections(i) };
+
+				const Vector3N halfVector{ Normalized(v + l) };
+
+				const FloatN normalDistribution{ NormalDistribution_GGX(n, halfVector, sqrtRoughness) };
+				const ColorN fresnel{ FresnelFunction_Schlick(halfVector, v, F0) };
+				const FloatN geometryFunction{ GeometryFunction_Smith(n, v, l, sqrtRoughness) };
+
+				const FloatN specularScale{ normalDistribution * geometryFunction / (SIMD::Broadcast(4.f) * Dot(v, n) * Dot(n, l)) };
+				ColorN color{ fresnel * specularScale };
+
+				//metals have no diffuse part
+				if (metalness == 0)
+				{
+					const FloatN one{ SIMD::Broadcast(1.f) };
+					color = color + Lambert({ one - fresnel.r, one - fresnel.g, one - fresnel.b }, albedo);
+				}
+
+				results.Set(i, color);
+			}
+		}
+
+		//Same as the exact batch, but the distribution and geometry terms are read from the tables
+		//The reads are the only per point step, everything around them stays in SIMD lanes
+		void ShadeWithTables(const ShadingBatch& batch, ShadingResults& results) const
+		{
+			using namespace BRDF::Wide;
+			const DistributionTable& distributionTable = DistributionTable::Get();
+
+			for (uint32_t i{ 0 }; i < batch.size; i += SIMD::NativeWidth)
+			{
+				const Vector3N n{ batch.GetNormals(i) };
+				const Vector3N l{ batch.GetDirectionsToLight(i) };
+				const Vector3N v{ batch.GetViewDirections(i) };
+
+				const Vector3N halfVector{ Normalized(v + l) };
+
+				alignas(32) float cosHalfVector[SIMD::NativeWidth], cosView[SIMD::NativeWidth], cosLight[SIMD::NativeWidth];
+				SIMD::Store(cosHalfVector, Dot(n, halfVector));
+				SIMD::Store(cosView, Dot(n, v));
+				SIMD::Store(cosLight, Dot(n, l));
+
+				alignas(32) float terms[SIMD::NativeWidth];
+				for (uint32_t lane{ 0 }; lane < SIMD::NativeWidth; ++lane)
+				{
+					terms[lane] = distributionTable.Lookup(cosHalfVector[lane], distributionRow) * pGeometryTable->Lookup(cosView[lane], cosLight[lane]);
+				}
+
+				//the geometry table is already divided by N.V * N.L
+				const ColorN fresnel{ FresnelFunction_Schlick(halfVector, v, F0) };
+				ColorN color{ fresnel * (SIMD::Load(terms) * SIMD::Broadcast(0.25f)) };
+
+				//metals have no diffuse part
+				if (metalness == 0)
+				{
+					const FloatN one{ SIMD::Broadcast(1.f) };
+					color = color + Lambert({ one - fresnel.r, one - fresnel.g, one - fresnel.b }, albedo);
+				}
+
+				results.Set(i, color);
+			}
+		}
+	};
+#pragma endregion
+
 #pragma region Material BASE
+	//Scenes describe their materials with the classes below, the renderer shades with the MaterialTable built from them
 	class Material
 	{
 	public:
-		Material() = default;
 		virtual ~Material() = default;
 
 		Material(const Material&) = delete;
@@ -17,125 +267,172 @@ namespace dae
 		Material& operator=(const Material&) = delete;
 		Material& operator=(Material&&) noexcept = delete;
 
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+		MaterialType GetType() const { return m_Type; }
+
+	protected:
+		explicit Material(MaterialType type) : m_Type{ type } {}
+
+	private:
+		MaterialType m_Type;
 	};
 #pragma endregion
 
 #pragma region Material SOLID COLOR
-	//SOLID COLOR
-	//===========
 	class Material_SolidColor final : public Material
 	{
 	public:
-		Material_SolidColor(const ColorRGB& color): m_Color(color)
+		Material_SolidColor(const ColorRGB& color) :
+			Material{ MaterialType::SolidColor }, m_Parameters{ color }
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
-		{
-			return m_Color;
-		}
+		const SolidColorMaterial& GetParameters() const { return m_Parameters; }
 
 	private:
-		ColorRGB m_Color{colors::White};
+		SolidColorMaterial m_Parameters{};
 	};
 #pragma endregion
 
 #pragma region Material LAMBERT
-	//LAMBERT
-	//=======
 	class Material_Lambert final : public Material
 	{
 	public:
 		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
-
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+			Material{ MaterialType::Lambert }, m_Parameters{ diffuseColor, diffuseReflectance }
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
 		}
 
+		const LambertMaterial& GetParameters() const { return m_Parameters; }
+
 	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{1.f}; //kd
+		LambertMaterial m_Parameters{};
 	};
 #pragma endregion
 
 #pragma region Material LAMBERT PHONG
-	//LAMBERT-PHONG
-	//=============
 	class Material_LambertPhong final : public Material
 	{
 	public:
-		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent):
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
-			m_PhongExponent(phongExponent)
+		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent) :
+			Material{ MaterialType::LambertPhong }, m_Parameters{ diffuseColor, kd, ks, phongExponent }
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
-		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor)
-				+ BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, -v, hitRecord.normal);
-		}
+		const LambertPhongMaterial& GetParameters() const { return m_Parameters; }
 
 	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{0.5f}; //kd
-		float m_SpecularReflectance{0.5f}; //ks
-		float m_PhongExponent{1.f}; //Phong Exponent
+		LambertPhongMaterial m_Parameters{};
 	};
 #pragma endregion
 
 #pragma region Material COOK TORRENCE
-	//COOK TORRENCE
 	class Material_CookTorrence final : public Material
 	{
 	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness) :
+			Material{ MaterialType::CookTorrence }, m_Parameters{ albedo, metalness, roughness }
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
-		{
-			//todo: W3
-			ColorRGB F0{};
-			(m_Metalness == 0) 
-				? F0 = { .04f, .04f, .04f }
-				: F0 = m_Albedo;
+		const CookTorrenceMaterial& GetParameters() const { return m_Parameters; }
 
-			const Vector3 halfVector{ (v + l).Normalized()};
-			const float sqrtRoughness{ m_Roughness * m_Roughness };
+	private:
+		CookTorrenceMaterial m_Parameters{};
+	};
+#pragma endregion
 
-			const float normalDistribution{ BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, sqrtRoughness) };
-			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(halfVector, v, F0) };
-			const float geometryFunction{ BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, sqrtRoughness) };
+#pragma region Material TABLE
+	//Closed, flat form of the scene materials: per material index a type tag and an index into that type's parameter array
+	//A switch on the tag replaces the virtual call, and a batch of hits sharing a material pays for it only once
+	class MaterialTable final
+	{
+	public:
+		MaterialTable() = default;
+		~MaterialTable() = default;
 
-			ColorRGB specular{ (normalDistribution * fresnel * geometryFunction) };
-			specular /= (4 * Vector3::Dot(v, hitRecord.normal) * Vector3::Dot(hitRecord.normal, l));
+		MaterialTable(const MaterialTable&) = delete;
+		MaterialTable(MaterialTable&&) noexcept = delete;
+		MaterialTable& operator=(const MaterialTable&) = delete;
+		MaterialTable& operator=(MaterialTable&&) noexcept = delete;
 
-			ColorRGB kd{};
-			(m_Metalness == 0)
-				? kd = ColorRGB(1, 1, 1) - fresnel
-				: kd = ColorRGB(0, 0, 0);
+		//Copies the material's parameters, returns its material index
+		unsigned char Add(const Material& material)
+		{
+			uint32_t parameterIndex{};
+			switch (material.GetType())
+			{
+			case MaterialType::SolidColor:
+				parameterIndex = AddParameters(m_SolidColors, static_cast<const Material_SolidColor&>(material).GetParameters());
+				break;
+			case MaterialType::Lambert:
+				parameterIndex = AddParameters(m_Lamberts, static_cast<const Material_Lambert&>(material).GetParameters());
+				break;
+			case MaterialType::LambertPhong:
+				parameterIndex = AddParameters(m_LambertPhongs, static_cast<const Material_LambertPhong&>(material).GetParameters());
+				break;
+			case MaterialType::CookTorrence:
+			{
+				CookTorrenceMaterial parameters{ static_cast<const Material_CookTorrence&>(material).GetParameters() };
+				parameters.Precompute();
+				parameters.pGeometryTable = &m_GeometryTables.emplace_back(parameters.roughness);
+				parameterIndex = AddParameters(m_CookTorrences, parameters);
+				break;
+			}
+			}
 
-			const ColorRGB diffuse{ BRDF::Lambert(kd, m_Albedo) };
+			m_Entries.push_back({ material.GetType(), parameterIndex });
+			return static_cast<unsigned char>(m_Entries.size() - 1);
+		}
 
-			return diffuse + specular;
+		uint32_t GetCount() const { return static_cast<uint32_t>(m_Entries.size()); }
+
+		//Calls function with the parameters of the material, every branch has to return the same type
+		template<typename Function>
+		decltype(auto) Visit(unsigned char materialIndex, Function&& function) const
+		{
+			const Entry& entry = m_Entries[materialIndex];
+			switch (entry.type)
+			{
+			case MaterialType::SolidColor:
+				return function(m_SolidColors[entry.parameterIndex]);
+			case MaterialType::Lambert:
+				return function(m_Lamberts[entry.parameterIndex]);
+			case MaterialType::LambertPhong:
+				return function(m_LambertPhongs[entry.parameterIndex]);
+			case MaterialType::CookTorrence:
+			default:
+				return function(m_CookTorrences[entry.parameterIndex]);
+			}
+		}
+
+		ColorRGB Shade(unsigned char materialIndex, const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			return Visit(materialIndex, [&](const auto& material) { return material.Shade(hitRecord, l, v); });
 		}
 
 	private:
-		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
-		float m_Metalness{1.0f};
-		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		struct Entry
+		{
+			MaterialType type;
+			uint32_t parameterIndex;
+		};
+
+		template<typename Parameters>
+		static uint32_t AddParameters(std::vector<Parameters>& parameters, const Parameters& material)
+		{
+			parameters.push_back(material);
+			return static_cast<uint32_t>(parameters.size() - 1);
+		}
+
+		std::vector<Entry> m_Entries{};
+
+		std::vector<SolidColorMaterial> m_SolidColors{};
+		std::vector<LambertMaterial> m_Lamberts{};
+		std::vector<LambertPhongMaterial> m_LambertPhongs{};
+		std::vector<CookTorrenceMaterial> m_CookTorrences{};
+
+		//a deque keeps the tables in place as it grows, the Cook-Torrance parameters point at them
+		std::deque<GeometryTable> m_GeometryTables{};
 	};
 #pragma endregion
 }
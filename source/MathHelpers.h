@@ -1,5 +1,6 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 
 namespace dae
 {
@@ -27,4 +28,37 @@ namespace dae
 	{
 		return abs(a - b) < epsilon;
 	}
-}
\ No newline at end of file
+
+	//Spreads the lower 16 bits of x so there is a zero bit between each of them
+	inline uint32_t SpreadBits2D(uint32_t x)
+	{
+		x &= 0x0000ffff;
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	//Z-order curve index of a 2D coordinate
+	inline uint32_t MortonEncode2D(uint32_t x, uint32_t y)
+	{
+		return SpreadBits2D(x) | (SpreadBits2D(y) << 1);
+	}
+
+	//Spreads the lower 10 bits of x so there are two zero bits between each of them
+	inline uint32_t SpreadBits3D(uint32_t x)
+	{
+		x = (x * 0x00010001u) & 0xFF0000FFu;
+		x = (x * 0x00000101u) & 0x0F00F00Fu;
+		x = (x * 0x00000011u) & 0xC30C30C3u;
+		x = (x * 0x00000005u) & 0x49249249u;
+		return x;
+	}
+
+	//Z-order curve index of a 3D coordinate, 10 bits per axis with x in the highest bit of every triple
+	inline uint32_t MortonEncode3D(uint32_t x, uint32_t y, uint32_t z)
+	{
+		return (SpreadBits3D(x) << 2) | (SpreadBits3D(y) << 1) | SpreadBits3D(z);
+	}
+}
@@ -1,53 +1,356 @@
 #pragma once
 #include "Vector3.h"
 #include "Vector4.h"
+#include "SIMD.h"
+#include <cassert>
+#include <cmath>
+#include <span>
+#include <type_traits>
 
 namespace dae {
+	//Defined in the header so the transforms inline into the mesh and instance updates
+	//With SSE the products run on whole rows, constant evaluation takes the scalar path, both add in the same order
 	struct Matrix
 	{
-		Matrix() = default;
-		Matrix(
+		constexpr Matrix() = default;
+		constexpr Matrix(
 			const Vector3& xAxis,
 			const Vector3& yAxis,
 			const Vector3& zAxis,
-			const Vector3& t);
+			const Vector3& t) :
+			Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
+		{
+		}
 
-		Matrix(
+		constexpr Matrix(
 			const Vector4& xAxis,
 			const Vector4& yAxis,
 			const Vector4& zAxis,
-			const Vector4& t);
-
-		Matrix(const Matrix& m);
-
-		Vector3 TransformVector(const Vector3& v) const;
-		Vector3 TransformVector(float x, float y, float z) const;
-		Vector3 TransformPoint(const Vector3& p) const;
-		Vector3 TransformPoint(float x, float y, float z) const;
-		const Matrix& Transpose();
-
-		Vector3 GetAxisX() const;
-		Vector3 GetAxisY() const;
-		Vector3 GetAxisZ() const;
-		Vector3 GetTranslation() const;
-
-		static Matrix CreateTranslation(float x, float y, float z);
-		static Matrix CreateTranslation(const Vector3& t);
-		static Matrix CreateRotationX(float pitch);
-		static Matrix CreateRotationY(float yaw);
-		static Matrix CreateRotationZ(float roll);
-		static Matrix CreateRotation(float pitch, float yaw, float roll);
-		static Matrix CreateRotation(const Vector3& r);
-		static Matrix CreateScale(float sx, float sy, float sz);
-		static Matrix CreateScale(const Vector3& s);
-		static Matrix Transpose(const Matrix& m);
-
-		Vector4& operator[](int index);
-		Vector4 operator[](int index) const;
-		Matrix operator*(const Matrix& m) const;
-		const Matrix& operator*=(const Matrix& m);
+			const Vector4& t) :
+			data{ xAxis, yAxis, zAxis, t }
+		{
+		}
+
+		constexpr Vector3 TransformVector(const Vector3& v) const
+		{
+			return TransformVector(v.x, v.y, v.z);
+		}
+
+		constexpr Vector3 TransformVector(float x, float y, float z) const
+		{
+#if defined(DAE_SIMD_SSE)
+			if (!std::is_constant_evaluated())
+			{
+				return ToVector3(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(LoadRow(0), _mm_set1_ps(x)),
+					_mm_mul_ps(LoadRow(1), _mm_set1_ps(y))),
+					_mm_mul_ps(LoadRow(2), _mm_set1_ps(z))));
+			}
+#endif
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z,
+				data[0].y * x + data[1].y * y + data[2].y * z,
+				data[0].z * x + data[1].z * y + data[2].z * z
+			};
+		}
+
+		constexpr Vector3 TransformPoint(const Vector3& p) const
+		{
+			return TransformPoint(p.x, p.y, p.z);
+		}
+
+		constexpr Vector3 TransformPoint(float x, float y, float z) const
+		{
+#if defined(DAE_SIMD_SSE)
+			if (!std::is_constant_evaluated())
+			{
+				return ToVector3(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(LoadRow(0), _mm_set1_ps(x)),
+					_mm_mul_ps(LoadRow(1), _mm_set1_ps(y))),
+					_mm_mul_ps(LoadRow(2), _mm_set1_ps(z))),
+					LoadRow(3)));
+			}
+#endif
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z + data[3].x,
+				data[0].y * x + data[1].y * y + data[2].y * z + data[3].y,
+				data[0].z * x + data[1].z * y + data[2].z * z + data[3].z,
+			};
+		}
+
+		//Batch versions for whole vertex buffers, out has to hold as many elements as in and nothing is allocated
+		//Results match TransformPoint/TransformVector exactly, with SSE four vectors are transformed per iteration
+		void TransformPoints(std::span<const Vector3> in, std::span<Vector3> out) const
+		{
+			TransformBatch<true>(in, out);
+		}
+
+		void TransformVectors(std::span<const Vector3> in, std::span<Vector3> out) const
+		{
+			TransformBatch<false>(in, out);
+		}
+
+		constexpr const Matrix& Transpose()
+		{
+#if defined(DAE_SIMD_SSE)
+			if (!std::is_constant_evaluated())
+			{
+				__m128 row0{ LoadRow(0) }, row1{ LoadRow(1) }, row2{ LoadRow(2) }, row3{ LoadRow(3) };
+				_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+				StoreRow(0, row0);
+				StoreRow(1, row1);
+				StoreRow(2, row2);
+				StoreRow(3, row3);
+				return *this;
+			}
+#endif
+			Matrix result{};
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					result[r][c] = data[c][r];
+				}
+			}
+
+			data[0] = result[0];
+			data[1] = result[1];
+			data[2] = result[2];
+			data[3] = result[3];
+
+			return *this;
+		}
+
+		//Only valid for affine transforms (last column 0, 0, 0, 1), which is all this matrix is used for
+		const Matrix& Inverse()
+		{
+			const Vector3 xAxis{ GetAxisX() }, yAxis{ GetAxisY() }, zAxis{ GetAxisZ() };
+			const float invDeterminant{ 1.f / Vector3::Dot(xAxis, Vector3::Cross(yAxis, zAxis)) };
+			assert(std::isfinite(invDeterminant));
+
+			//the columns of the inverse are the cross products of the other two rows
+			Matrix result{
+				Vector3::Cross(yAxis, zAxis) * invDeterminant,
+				Vector3::Cross(zAxis, xAxis) * invDeterminant,
+				Vector3::Cross(xAxis, yAxis) * invDeterminant,
+				Vector3::Zero
+			};
+			result.Transpose();
+			result[3] = { -result.TransformVector(GetTranslation()), 1 };
+
+			data[0] = result[0];
+			data[1] = result[1];
+			data[2] = result[2];
+			data[3] = result[3];
+
+			return *this;
+		}
+
+		constexpr Vector3 GetAxisX() const { return data[0]; }
+		constexpr Vector3 GetAxisY() const { return data[1]; }
+		constexpr Vector3 GetAxisZ() const { return data[2]; }
+		constexpr Vector3 GetTranslation() const { return data[3]; }
+
+		static constexpr Matrix CreateTranslation(float x, float y, float z)
+		{
+			return CreateTranslation({ x, y, z });
+		}
+
+		static constexpr Matrix CreateTranslation(const Vector3& t)
+		{
+			return { Vector3::UnitX, Vector3::UnitY, Vector3::UnitZ, t };
+		}
+
+		static Matrix CreateRotationX(float pitch)
+		{
+			return {
+				{1, 0, 0, 0},
+				{0, std::cos(pitch), -std::sin(pitch), 0},
+				{0, std::sin(pitch), std::cos(pitch), 0},
+				{0, 0, 0, 1}
+			};
+		}
+
+		static Matrix CreateRotationY(float yaw)
+		{
+			return {
+				{std::cos(yaw), 0, -std::sin(yaw), 0},
+				{0, 1, 0, 0},
+				{std::sin(yaw), 0, std::cos(yaw), 0},
+				{0, 0, 0, 1}
+			};
+		}
+
+		static Matrix CreateRotationZ(float roll)
+		{
+			return {
+				{std::cos(roll), std::sin(roll), 0, 0},
+				{-std::sin(roll), std::cos(roll), 0, 0},
+				{0, 0, 1, 0},
+				{0, 0, 0, 1}
+			};
+		}
+
+		static Matrix CreateRotation(float pitch, float yaw, float roll)
+		{
+			return CreateRotation({ pitch, yaw, roll });
+		}
+
+		static Matrix CreateRotation(const Vector3& r)
+		{
+			return { CreateRotationX(r.x) * CreateRotationY(r.y) * CreateRotationZ(r.z) };
+		}
+
+		static constexpr Matrix CreateScale(float sx, float sy, float sz)
+		{
+			return {
+				{sx, 0, 0, 0},
+				{0, sy, 0, 0},
+				{0, 0, sz, 0},
+				{0, 0, 0, 1}
+			};
+		}
+
+		static constexpr Matrix CreateScale(const Vector3& s)
+		{
+			return CreateScale(s.x, s.y, s.z);
+		}
+
+		static constexpr Matrix Transpose(const Matrix& m)
+		{
+			Matrix out{ m };
+			out.Transpose();
+
+			return out;
+		}
+
+		static Matrix Inverse(const Matrix& m)
+		{
+			Matrix out{ m };
+			out.Inverse();
+
+			return out;
+		}
+
+#pragma region Operator Overloads
+		constexpr Vector4& operator[](int index)
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		constexpr Vector4 operator[](int index) const
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		constexpr Matrix operator*(const Matrix& m) const
+		{
+			Matrix result{ *this };
+			result *= m;
+
+			return result;
+		}
+
+		constexpr const Matrix& operator*=(const Matrix& m)
+		{
+#if defined(DAE_SIMD_SSE)
+			if (!std::is_constant_evaluated())
+			{
+				//row r of the product is row r of this matrix weighing the rows of m
+				const __m128 mRow0{ m.LoadRow(0) }, mRow1{ m.LoadRow(1) }, mRow2{ m.LoadRow(2) }, mRow3{ m.LoadRow(3) };
+				for (int r{ 0 }; r < 4; ++r)
+				{
+					const Vector4 row{ data[r] };
+					StoreRow(r, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(_mm_set1_ps(row.x), mRow0),
+						_mm_mul_ps(_mm_set1_ps(row.y), mRow1)),
+						_mm_mul_ps(_mm_set1_ps(row.z), mRow2)),
+						_mm_mul_ps(_mm_set1_ps(row.w), mRow3)));
+				}
+				return *this;
+			}
+#endif
+			const Matrix copy{ *this };
+			const Matrix m_transposed{ Transpose(m) };
+
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					data[r][c] = Vector4::Dot(copy[r], m_transposed[c]);
+				}
+			}
+
+			return *this;
+		}
+#pragma endregion
 
 	private:
+		template<bool IsPoint>
+		void TransformBatch(std::span<const Vector3> in, std::span<Vector3> out) const
+		{
+			assert(out.size() >= in.size());
+			size_t i{ 0 };
+#if defined(DAE_SIMD_SSE)
+			const __m128 m00{ _mm_set1_ps(data[0].x) }, m01{ _mm_set1_ps(data[0].y) }, m02{ _mm_set1_ps(data[0].z) };
+			const __m128 m10{ _mm_set1_ps(data[1].x) }, m11{ _mm_set1_ps(data[1].y) }, m12{ _mm_set1_ps(data[1].z) };
+			const __m128 m20{ _mm_set1_ps(data[2].x) }, m21{ _mm_set1_ps(data[2].y) }, m22{ _mm_set1_ps(data[2].z) };
+			const __m128 m30{ _mm_set1_ps(data[3].x) }, m31{ _mm_set1_ps(data[3].y) }, m32{ _mm_set1_ps(data[3].z) };
+
+			for (; i + 4 <= in.size(); i += 4)
+			{
+				//x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3 to one register per axis
+				const float* pIn{ &in[i].x };
+				const __m128 a{ _mm_loadu_ps(pIn) }, b{ _mm_loadu_ps(pIn + 4) }, c{ _mm_loadu_ps(pIn + 8) };
+				const __m128 a12b01{ _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1)) };
+				const __m128 b2323{ _mm_shuffle_ps(b, c, _MM_SHUFFLE(3, 2, 3, 2)) };
+				const __m128 b23c01{ _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2)) };
+				const __m128 x{ _mm_shuffle_ps(a, b23c01, _MM_SHUFFLE(3, 0, 3, 0)) };
+				const __m128 y{ _mm_shuffle_ps(a12b01, b2323, _MM_SHUFFLE(2, 1, 2, 0)) };
+				const __m128 z{ _mm_shuffle_ps(a12b01, c, _MM_SHUFFLE(3, 0, 3, 1)) };
+
+				__m128 outX{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m10, y)), _mm_mul_ps(m20, z)) };
+				__m128 outY{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, x), _mm_mul_ps(m11, y)), _mm_mul_ps(m21, z)) };
+				__m128 outZ{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, x), _mm_mul_ps(m12, y)), _mm_mul_ps(m22, z)) };
+				if constexpr (IsPoint)
+				{
+					outX = _mm_add_ps(outX, m30);
+					outY = _mm_add_ps(outY, m31);
+					outZ = _mm_add_ps(outZ, m32);
+				}
+
+				//and back to the interleaved layout
+				const __m128 xyLow{ _mm_unpacklo_ps(outX, outY) }, xyHigh{ _mm_unpackhi_ps(outX, outY) };
+				const __m128 z0x1{ _mm_shuffle_ps(outZ, xyLow, _MM_SHUFFLE(2, 2, 0, 0)) };
+				const __m128 y1z1{ _mm_shuffle_ps(xyLow, outZ, _MM_SHUFFLE(1, 1, 3, 3)) };
+				const __m128 z2x3{ _mm_shuffle_ps(outZ, xyHigh, _MM_SHUFFLE(2, 2, 2, 2)) };
+				const __m128 y3z3{ _mm_shuffle_ps(xyHigh, outZ, _MM_SHUFFLE(3, 3, 3, 3)) };
+				float* pOut{ &out[i].x };
+				_mm_storeu_ps(pOut, _mm_shuffle_ps(xyLow, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+				_mm_storeu_ps(pOut + 4, _mm_shuffle_ps(y1z1, xyHigh, _MM_SHUFFLE(1, 0, 2, 0)));
+				_mm_storeu_ps(pOut + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+			}
+#endif
+			for (; i < in.size(); ++i)
+			{
+				if constexpr (IsPoint) out[i] = TransformPoint(in[i]);
+				else out[i] = TransformVector(in[i]);
+			}
+		}
+
+#if defined(DAE_SIMD_SSE)
+		__m128 LoadRow(int index) const { return _mm_loadu_ps(&data[index].x); }
+		void StoreRow(int index, __m128 row) { _mm_storeu_ps(&data[index].x, row); }
+
+		static Vector3 ToVector3(__m128 v)
+		{
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, v);
+			return { lanes[0], lanes[1], lanes[2] };
+		}
+#endif
 
 		//Row-Major Matrix
 		Vector4 data[4]
@@ -63,4 +366,4 @@ namespace dae {
 		// v2x v2y v2z v2w
 		// v3x v3y v3z v3w
 	};
-}
\ No newline at end of file
+}
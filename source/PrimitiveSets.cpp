@@ -0,0 +1,546 @@
+#include "PrimitiveSets.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <bit>
+
+using namespace dae;
+
+namespace
+{
+	//Spheres per chunk for the parallel builds and refits
+	constexpr uint32_t ParallelChunkSize{ 1u << 13 };
+
+	//Entry distance of the ray into the box, FLT_MAX on a miss
+	float IntersectBounds(const AABB& bounds, const Ray& ray)
+	{
+		const float tx1{ (bounds.minAABB.x - ray.origin.x) * ray.reciproke.x }, tx2{ (bounds.maxAABB.x - ray.origin.x) * ray.reciproke.x };
+		float tmin{ std::min(tx1, tx2) }, tmax{ std::max(tx1, tx2) };
+		const float ty1{ (bounds.minAABB.y - ray.origin.y) * ray.reciproke.y }, ty2{ (bounds.maxAABB.y - ray.origin.y) * ray.reciproke.y };
+		tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+		const float tz1{ (bounds.minAABB.z - ray.origin.z) * ray.reciproke.z }, tz2{ (bounds.maxAABB.z - ray.origin.z) * ray.reciproke.z };
+		tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+
+		//ray.max holds a squared distance, like in the primitive tests
+		if (tmax < tmin || tmax <= 0 || (tmin > 0 && tmin * tmin > ray.max)) return FLT_MAX;
+		return tmin;
+	}
+
+	//Lane of the nearest hit in hitMask, t holds the distances of all lanes
+	uint32_t GetClosestLane(uint32_t hitMask, const float* t)
+	{
+		uint32_t closestLane{ static_cast<uint32_t>(std::countr_zero(hitMask)) };
+		for (hitMask &= hitMask - 1; hitMask; hitMask &= hitMask - 1)
+		{
+			const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(hitMask)) };
+			if (t[lane] < t[closestLane]) closestLane = lane;
+		}
+		return closestLane;
+	}
+}
+
+#pragma region SphereSet
+void SphereSet::Build(const std::vector<Sphere>& spheres)
+{
+	const uint32_t count{ static_cast<uint32_t>(spheres.size()) };
+	const uint32_t blockCount{ (count + BlockSize - 1) / BlockSize };
+
+	m_NodesUsed = 0;
+	m_Blocks.assign(blockCount, Block{});
+	m_SphereIndices.resize(count);
+	if (count == 0) return;
+
+	AABB centerBounds{};
+	for (const Sphere& sphere : spheres) centerBounds.Grow(sphere.origin);
+
+	const Vector3 extent{ centerBounds.maxAABB - centerBounds.minAABB };
+	const Vector3 scale{
+		extent.x > 0 ? 1023.f / extent.x : 0.f,
+		extent.y > 0 ? 1023.f / extent.y : 0.f,
+		extent.z > 0 ? 1023.f / extent.z : 0.f };
+
+	//sort keys hold the Morton code of the centre above the sphere index
+	ThreadPool& threadPool{ ThreadPool::Get() };
+	std::vector<uint64_t> keys(count);
+	threadPool.ParallelFor(0, count, ParallelChunkSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const Vector3 position{ spheres[i].origin - centerBounds.minAABB };
+			const uint32_t mortonCode{ MortonEncode3D(
+				static_cast<uint32_t>(position.x * scale.x),
+				static_cast<uint32_t>(position.y * scale.y),
+				static_cast<uint32_t>(position.z * scale.z)) };
+			keys[i] = static_cast<uint64_t>(mortonCode) << 32 | i;
+		}
+	});
+	std::sort(keys.begin(), keys.end());
+
+	//a block splits the tree by the code of its first sphere
+	std::vector<uint32_t> blockCodes(blockCount);
+	threadPool.ParallelFor(0, blockCount, ParallelChunkSize / BlockSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t block = begin; block < end; ++block)
+		{
+			blockCodes[block] = static_cast<uint32_t>(keys[block * BlockSize] >> 32);
+
+			const uint32_t slotEnd{ std::min((block + 1) * BlockSize, count) };
+			for (uint32_t slot = block * BlockSize; slot < slotEnd; ++slot)
+			{
+				m_SphereIndices[slot] = static_cast<uint32_t>(keys[slot]);
+				StoreSphere(slot, spheres[m_SphereIndices[slot]]);
+			}
+		}
+	});
+
+	//a binary tree over n leaves never needs more than 2n - 1 nodes
+	m_Nodes.resize(blockCount * 2 - 1);
+	BVHNode& root = m_Nodes[m_NodesUsed++];
+	root.leftFirst = 0;
+	root.triCount = blockCount;
+	Subdivide(0, blockCodes.data());
+
+	m_BuildCost = m_Cost = RefitNodes();
+}
+
+void SphereSet::Refit(const std::vector<Sphere>& spheres)
+{
+	if (spheres.size() != GetSphereCount())
+	{
+		Build(spheres);
+		return;
+	}
+
+	const uint32_t count{ GetSphereCount() };
+	ThreadPool::Get().ParallelFor(0, count, ParallelChunkSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t slot = begin; slot < end; ++slot)
+		{
+			StoreSphere(slot, spheres[m_SphereIndices[slot]]);
+		}
+	});
+
+	m_Cost = RefitNodes();
+
+	//spheres that travelled far from where the tree grouped them leave large overlapping boxes, a new Morton order fixes that
+	if (GetCostRatio() > RebuildCostRatio) Build(spheres);
+}
+
+void SphereSet::StoreSphere(uint32_t slot, const Sphere& sphere)
+{
+	Block& block{ m_Blocks[slot / BlockSize] };
+	const uint32_t lane{ slot % BlockSize };
+
+	block.centerX[lane] = sphere.origin.x;
+	block.centerY[lane] = sphere.origin.y;
+	block.centerZ[lane] = sphere.origin.z;
+	block.radius[lane] = sphere.radius;
+	block.materialIndex[lane] = sphere.materialIndex;
+	block.laneMask |= 1u << lane;
+}
+
+void SphereSet::Subdivide(uint32_t nodeIdx, const uint32_t* blockCodes)
+{
+	BVHNode& node = m_Nodes[nodeIdx];
+	if (node.triCount <= MaxLeafBlocks) return;
+
+	const uint32_t first{ node.leftFirst };
+	const uint32_t last{ node.leftFirst + node.triCount - 1 };
+
+	//split where the highest bit that differs in the range flips, identical codes are split in the middle
+	uint32_t split{ first + node.triCount / 2 };
+	if (blockCodes[first] != blockCodes[last])
+	{
+		const int commonPrefix{ std::countl_zero(blockCodes[first] ^ blockCodes[last]) };
+
+		//binary search for the last code that still shares more than the common prefix with the first one
+		uint32_t lastLeft{ first };
+		uint32_t step{ node.triCount - 1 };
+		do
+		{
+			step = (step + 1) >> 1;
+			const uint32_t candidate{ lastLeft + step };
+			if (candidate < last && std::countl_zero(blockCodes[first] ^ blockCodes[candidate]) > commonPrefix)
+				lastLeft = candidate;
+		} while (step > 1);
+
+		split = lastLeft + 1;
+	}
+
+	const uint32_t leftChildIdx{ m_NodesUsed };
+	m_NodesUsed += 2;
+	m_Nodes[leftChildIdx].leftFirst = first;
+	m_Nodes[leftChildIdx].triCount = split - first;
+	m_Nodes[leftChildIdx + 1].leftFirst = split;
+	m_Nodes[leftChildIdx + 1].triCount = last + 1 - split;
+	node.leftFirst = leftChildIdx;
+	node.triCount = 0;
+
+	Subdivide(leftChildIdx, blockCodes);
+	Subdivide(leftChildIdx + 1, blockCodes);
+}
+
+float SphereSet::RefitNodes()
+{
+	if (m_NodesUsed == 0) return 1.f;
+
+	//leaves read their spheres, which is most of the work for millions of them
+	ThreadPool::Get().ParallelFor(0, m_NodesUsed, ParallelChunkSize / BlockSize, [this](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t nodeIdx = begin; nodeIdx < end; ++nodeIdx)
+		{
+			BVHNode& node = m_Nodes[nodeIdx];
+			if (!node.isLeaf()) continue;
+
+			node.bounds = {};
+			for (uint32_t blockIdx = node.leftFirst; blockIdx < node.leftFirst + node.triCount; ++blockIdx)
+			{
+				const Block& block{ m_Blocks[blockIdx] };
+				for (uint32_t mask = block.laneMask; mask; mask &= mask - 1)
+				{
+					const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(mask)) };
+					const Vector3 center{ block.centerX[lane], block.centerY[lane], block.centerZ[lane] };
+					const Vector3 radius{ block.radius[lane], block.radius[lane], block.radius[lane] };
+					node.bounds.Grow(AABB{ center - radius, center + radius });
+				}
+			}
+		}
+	});
+
+	//children always follow their parent, so walking the nodes backwards finishes both children first
+	float cost{ 0 };
+	for (uint32_t nodeIdx = m_NodesUsed; nodeIdx-- > 0;)
+	{
+		BVHNode& node = m_Nodes[nodeIdx];
+		if (!node.isLeaf())
+		{
+			node.bounds = m_Nodes[node.leftFirst].bounds;
+			node.bounds.Grow(m_Nodes[node.leftFirst + 1].bounds);
+		}
+
+		//a leaf costs a SIMD test per block, an interior node one box test
+		cost += node.bounds.area() * (node.isLeaf() ? node.triCount : 1);
+	}
+
+	//relative to the root, so only the arrangement counts and not how far the spheres spread
+	const float rootArea{ m_Nodes[0].bounds.area() };
+	return rootArea > 0 ? cost / rootArea : 1.f;
+}
+
+uint32_t SphereSet::IntersectBlock(const Block& block, const Ray& ray, float tClosest, float* t)
+{
+	using namespace SIMD;
+
+	//with a normalized direction the quadratic's A is 1, B and the discriminant lose their factors 2 and 4
+	const FloatN toOriginX{ Broadcast(ray.origin.x) - Load(block.centerX) };
+	const FloatN toOriginY{ Broadcast(ray.origin.y) - Load(block.centerY) };
+	const FloatN toOriginZ{ Broadcast(ray.origin.z) - Load(block.centerZ) };
+	const FloatN radius{ Load(block.radius) };
+
+	const FloatN halfB{ Broadcast(ray.direction.x) * toOriginX + Broadcast(ray.direction.y) * toOriginY + Broadcast(ray.direction.z) * toOriginZ };
+	const FloatN C{ toOriginX * toOriginX + toOriginY * toOriginY + toOriginZ * toOriginZ - radius * radius };
+	const FloatN discriminant{ halfB * halfB - C };
+
+	//only the near root counts, like HitTest_Sphere: rays starting inside a sphere miss it
+	const FloatN tNear{ Broadcast(0.f) - halfB - Sqrt(Max(discriminant, Broadcast(0.f))) };
+	Store(t, tNear);
+
+	const FloatN hit{ And(
+		And(GreaterEqual(discriminant, Broadcast(0.f)), GreaterEqual(tNear, Broadcast(ray.min))),
+		And(LessEqual(tNear * tNear, Broadcast(ray.max)), Less(tNear, Broadcast(tClosest)))) };
+
+	return MoveMask(hit) & block.laneMask;
+}
+
+void SphereSet::HitTestBlock(uint32_t blockIndex, const Ray& ray, HitRecord& closestHit) const
+{
+	const Block& block{ m_Blocks[blockIndex] };
+
+	alignas(32) float t[BlockSize];
+	const uint32_t hitMask{ IntersectBlock(block, ray, closestHit.t, t) };
+	if (hitMask == 0) return;
+
+	const uint32_t lane{ GetClosestLane(hitMask, t) };
+	const Vector3 center{ block.centerX[lane], block.centerY[lane], block.centerZ[lane] };
+
+	closestHit.didHit = true;
+	closestHit.materialIndex = block.materialIndex[lane];
+	closestHit.t = t[lane];
+	closestHit.origin = ray.origin + (t[lane] * ray.direction);
+	closestHit.normal = (closestHit.origin - center).Normalized();
+}
+
+bool SphereSet::DoesHitBlock(uint32_t blockIndex, const Ray& ray) const
+{
+	alignas(32) float t[BlockSize];
+	return IntersectBlock(m_Blocks[blockIndex], ray, FLT_MAX, t) != 0;
+}
+
+void SphereSet::HitTest(const Ray& ray, HitRecord& closestHit) const
+{
+	if (m_NodesUsed == 0) return;
+
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		float dist;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+
+	const float rootDist{ IntersectBounds(m_Nodes[0].bounds, ray) };
+	if (rootDist == FLT_MAX) return;
+	stack[stackPtr++] = { 0, rootDist };
+
+	while (stackPtr > 0)
+	{
+		const StackEntry entry{ stack[--stackPtr] };
+
+		//a closer hit was found since this node was pushed
+		if (entry.dist >= closestHit.t) continue;
+
+		const BVHNode& node = m_Nodes[entry.nodeIdx];
+		if (node.isLeaf())
+		{
+			for (uint32_t block = node.leftFirst; block < node.leftFirst + node.triCount; ++block)
+			{
+				HitTestBlock(block, ray, closestHit);
+			}
+			continue;
+		}
+
+		uint32_t child1{ node.leftFirst }, child2{ node.leftFirst + 1 };
+		float dist1{ IntersectBounds(m_Nodes[child1].bounds, ray) };
+		float dist2{ IntersectBounds(m_Nodes[child2].bounds, ray) };
+
+		if (dist1 > dist2)
+		{
+			std::swap(dist1, dist2);
+			std::swap(child1, child2);
+		}
+
+		//far child first, so the near one is popped next
+		if (dist2 < closestHit.t) stack[stackPtr++] = { child2, dist2 };
+		if (dist1 < closestHit.t) stack[stackPtr++] = { child1, dist1 };
+	}
+}
+
+bool SphereSet::DoesHit(const Ray& ray) const
+{
+	if (m_NodesUsed == 0) return false;
+
+	uint32_t stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = 0;
+
+	while (stackPtr > 0)
+	{
+		const BVHNode& node = m_Nodes[stack[--stackPtr]];
+		if (IntersectBounds(node.bounds, ray) == FLT_MAX) continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t block = node.leftFirst; block < node.leftFirst + node.triCount; ++block)
+			{
+				if (DoesHitBlock(block, ray)) return true;
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = node.leftFirst + 1;
+		stack[stackPtr++] = node.leftFirst;
+	}
+
+	return false;
+}
+
+void SphereSet::IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const
+{
+	if (m_NodesUsed == 0) return;
+
+	alignas(32) float closestT[RayPacket::Size];
+	for (uint32_t i = 0; i < RayPacket::Size; ++i)
+	{
+		closestT[i] = hitRecords[i].t;
+	}
+
+	//one stack for the whole packet, every entry remembers which rays reached the node
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+
+	float entry;
+	const uint32_t rootMask{ packet.IntersectBounds(m_Nodes[0].bounds, rayMask, closestT, entry) };
+	if (rootMask) stack[stackPtr++] = { 0, rootMask };
+
+	while (stackPtr > 0)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_Nodes[current.nodeIdx];
+
+		if (node.isLeaf())
+		{
+			//the blocks are wide already, so the rays go one by one
+			for (uint32_t mask = current.rayMask; mask; mask &= mask - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+				const Ray ray{ packet.GetRay(i) };
+				for (uint32_t block = node.leftFirst; block < node.leftFirst + node.triCount; ++block)
+				{
+					HitTestBlock(block, ray, hitRecords[i]);
+				}
+				closestT[i] = hitRecords[i].t;
+			}
+			continue;
+		}
+
+		uint32_t child1{ node.leftFirst }, child2{ node.leftFirst + 1 };
+		float entry1, entry2;
+		uint32_t mask1{ packet.IntersectBounds(m_Nodes[child1].bounds, current.rayMask, closestT, entry1) };
+		uint32_t mask2{ packet.IntersectBounds(m_Nodes[child2].bounds, current.rayMask, closestT, entry2) };
+
+		if (entry1 > entry2)
+		{
+			std::swap(entry1, entry2);
+			std::swap(child1, child2);
+			std::swap(mask1, mask2);
+		}
+
+		//far child first, so the near one is popped next
+		if (mask2) stack[stackPtr++] = { child2, mask2 };
+		if (mask1) stack[stackPtr++] = { child1, mask1 };
+	}
+}
+
+uint32_t SphereSet::GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const
+{
+	if (m_NodesUsed == 0) return 0;
+
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = { 0, rayMask };
+
+	uint32_t occludedMask{ 0 };
+	float entry;
+
+	while (stackPtr > 0 && occludedMask != rayMask)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_Nodes[current.nodeIdx];
+
+		//the reversed rays only cull boxes, the spheres below see every ray in its own direction
+		const uint32_t nodeMask{ packet.reversed.IntersectBounds(node.bounds, current.rayMask & ~occludedMask, packet.length, entry) };
+		if (nodeMask == 0) continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t mask = nodeMask; mask; mask &= mask - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+				for (uint32_t block = node.leftFirst; block < node.leftFirst + node.triCount; ++block)
+				{
+					if (DoesHitBlock(block, packet.rays[i]))
+					{
+						occludedMask |= 1u << i;
+						break;
+					}
+				}
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = { node.leftFirst + 1, nodeMask };
+		stack[stackPtr++] = { node.leftFirst, nodeMask };
+	}
+
+	return occludedMask;
+}
+#pragma endregion
+
+#pragma region PlaneSet
+void PlaneSet::Build(const std::vector<Plane>& planes)
+{
+	const uint32_t count{ static_cast<uint32_t>(planes.size()) };
+	m_Blocks.assign((count + BlockSize - 1) / BlockSize, Block{});
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		Block& block{ m_Blocks[i / BlockSize] };
+		const uint32_t lane{ i % BlockSize };
+
+		block.normalX[lane] = planes[i].normal.x;
+		block.normalY[lane] = planes[i].normal.y;
+		block.normalZ[lane] = planes[i].normal.z;
+		block.distance[lane] = Vector3::Dot(planes[i].origin, planes[i].normal);
+		block.materialIndex[lane] = planes[i].materialIndex;
+		block.laneMask |= 1u << lane;
+	}
+}
+
+uint32_t PlaneSet::IntersectBlock(const Block& block, const Ray& ray, float tClosest, float* t)
+{
+	using namespace SIMD;
+
+	const FloatN normalX{ Load(block.normalX) }, normalY{ Load(block.normalY) }, normalZ{ Load(block.normalZ) };
+	const FloatN originDistance{ Load(block.distance) - (Broadcast(ray.origin.x) * normalX + Broadcast(ray.origin.y) * normalY + Broadcast(ray.origin.z) * normalZ) };
+	const FloatN dirDotNormal{ Broadcast(ray.direction.x) * normalX + Broadcast(ray.direction.y) * normalY + Broadcast(ray.direction.z) * normalZ };
+
+	//parallel rays divide by zero, their infinite or NaN distances fail the range tests
+	const FloatN tPlane{ originDistance / dirDotNormal };
+	Store(t, tPlane);
+
+	const FloatN hit{ And(
+		And(GreaterEqual(tPlane, Broadcast(ray.min)), LessEqual(tPlane * tPlane, Broadcast(ray.max))),
+		Less(tPlane, Broadcast(tClosest))) };
+
+	return MoveMask(hit) & block.laneMask;
+}
+
+void PlaneSet::HitTest(const Ray& ray, HitRecord& closestHit) const
+{
+	//the closest hit so far bounds the next blocks, the record is only written once at the end
+	const Block* pClosestBlock{ nullptr };
+	uint32_t closestLane{ 0 };
+	float tClosest{ closestHit.t };
+
+	for (const Block& block : m_Blocks)
+	{
+		alignas(32) float t[BlockSize];
+		const uint32_t hitMask{ IntersectBlock(block, ray, tClosest, t) };
+		if (hitMask == 0) continue;
+
+		closestLane = GetClosestLane(hitMask, t);
+		tClosest = t[closestLane];
+		pClosestBlock = &block;
+	}
+
+	if (!pClosestBlock) return;
+
+	closestHit.didHit = true;
+	closestHit.materialIndex = pClosestBlock->materialIndex[closestLane];
+	closestHit.normal = { pClosestBlock->normalX[closestLane], pClosestBlock->normalY[closestLane], pClosestBlock->normalZ[closestLane] };
+	closestHit.origin = ray.origin + ray.direction * tClosest;
+	closestHit.t = tClosest;
+}
+
+bool PlaneSet::DoesHit(const Ray& ray) const
+{
+	for (const Block& block : m_Blocks)
+	{
+		alignas(32) float t[BlockSize];
+		if (IntersectBlock(block, ray, FLT_MAX, t) != 0) return true;
+	}
+	return false;
+}
+#pragma endregion
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "DataTypes.h"
+#include "SIMD.h"
+#include <vector>
+
+namespace dae
+{
+	struct RayPacket;
+	struct ShadowRayPacket;
+
+	//Spheres in structure of arrays blocks of SIMD::NativeWidth under a BVH over the blocks, made for scenes with up to millions of spheres
+	//Blocks take the spheres in Morton order of their centres, so a block holds neighbours and its bounds stay tight,
+	//the tree splits the block sequence where the highest bit of the Morton codes flips, like the mesh LBVH
+	class SphereSet final
+	{
+	public:
+		static constexpr uint32_t BlockSize{ SIMD::NativeWidth };
+		//Leaves hold at most this many blocks, about 8 spheres whatever the SIMD width
+		static constexpr uint32_t MaxLeafBlocks{ (8 + BlockSize - 1) / BlockSize };
+		//Refits whose SAH cost grows past this multiple of the freshly built cost rebuild the set instead
+		static constexpr float RebuildCostRatio{ 1.5f };
+
+		SphereSet() = default;
+		~SphereSet() = default;
+
+		SphereSet(const SphereSet&) = delete;
+		SphereSet(SphereSet&&) noexcept = delete;
+		SphereSet& operator=(const SphereSet&) = delete;
+		SphereSet& operator=(SphereSet&&) noexcept = delete;
+
+		void Build(const std::vector<Sphere>& spheres);
+		//Moves the blocks and node bounds to the current centres and radii, the tree keeps its topology
+		//spheres has to hold the spheres of the last Build in the same order, a changed count or a degraded tree rebuilds it
+		void Refit(const std::vector<Sphere>& spheres);
+
+		uint32_t GetSphereCount() const { return static_cast<uint32_t>(m_SphereIndices.size()); }
+		bool IsEmpty() const { return m_NodesUsed == 0; }
+		const AABB& GetBounds() const { return m_Nodes[0].bounds; }
+		//SAH cost of the current tree relative to the cost it had right after it was built, refits far from the build raise it
+		float GetCostRatio() const { return m_Cost / m_BuildCost; }
+
+		//Ray directions have to be normalized
+		//Only replaces closestHit when a sphere is hit closer than closestHit.t
+		void HitTest(const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHit(const Ray& ray) const;
+
+		//HitTest for the rays in rayMask, the packet culls the nodes and the leaves test their blocks ray by ray
+		void IntersectPacket(const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const;
+		//DoesHit for the rays in rayMask, returns the mask of the rays that hit a sphere
+		uint32_t GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const;
+
+	private:
+		//Centre plus radius per lane, 16 bytes of hot data per sphere
+		struct alignas(32) Block
+		{
+			float centerX[BlockSize]{}, centerY[BlockSize]{}, centerZ[BlockSize]{};
+			float radius[BlockSize]{};
+			unsigned char materialIndex[BlockSize]{};
+			uint32_t laneMask{ 0 }; //lanes holding a sphere, only the last block can be partly filled
+		};
+
+		//Mask of the lanes hit within [ray.min, ray.max] and before tClosest, t receives their distances
+		static uint32_t IntersectBlock(const Block& block, const Ray& ray, float tClosest, float* t);
+		//Only replaces closestHit when a sphere of the block is hit closer than closestHit.t
+		void HitTestBlock(uint32_t block, const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHitBlock(uint32_t block, const Ray& ray) const;
+
+		void StoreSphere(uint32_t slot, const Sphere& sphere);
+		void Subdivide(uint32_t nodeIdx, const uint32_t* blockCodes);
+		//Recomputes every node's bounds bottom up and returns the SAH cost of the tree
+		float RefitNodes();
+
+		std::vector<Block> m_Blocks{};
+		std::vector<uint32_t> m_SphereIndices{}; //index into the sphere list Build saw, per block slot
+		std::vector<BVHNode> m_Nodes{}; //leftFirst/triCount index into m_Blocks for leaves, children always follow their parent
+		uint32_t m_NodesUsed{ 0 };
+
+		float m_BuildCost{ 1.f };
+		float m_Cost{ 1.f };
+	};
+
+	//All planes of a scene in structure of arrays blocks of SIMD::NativeWidth, planes are unbounded so every ray tests all of them
+	class PlaneSet final
+	{
+	public:
+		static constexpr uint32_t BlockSize{ SIMD::NativeWidth };
+
+		PlaneSet() = default;
+		~PlaneSet() = default;
+
+		PlaneSet(const PlaneSet&) = delete;
+		PlaneSet(PlaneSet&&) noexcept = delete;
+		PlaneSet& operator=(const PlaneSet&) = delete;
+		PlaneSet& operator=(PlaneSet&&) noexcept = delete;
+
+		void Build(const std::vector<Plane>& planes);
+
+		//Only replaces closestHit when a plane is hit closer than closestHit.t
+		void HitTest(const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHit(const Ray& ray) const;
+
+	private:
+		struct alignas(32) Block
+		{
+			float normalX[BlockSize]{}, normalY[BlockSize]{}, normalZ[BlockSize]{};
+			float distance[BlockSize]{}; //dot(origin, normal), the plane is dot(p, normal) = distance
+			unsigned char materialIndex[BlockSize]{};
+			uint32_t laneMask{ 0 };
+		};
+
+		static uint32_t IntersectBlock(const Block& block, const Ray& ray, float tClosest, float* t);
+
+		std::vector<Block> m_Blocks{};
+	};
+}
@@ -0,0 +1,164 @@
+#include "RayPacket.h"
+#include "SIMD.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+void dae::RayPacket::SetRay(uint32_t i, const Ray& ray)
+{
+	directionX[i] = ray.direction.x;
+	directionY[i] = ray.direction.y;
+	directionZ[i] = ray.direction.z;
+	reciprokeX[i] = ray.reciproke.x;
+	reciprokeY[i] = ray.reciproke.y;
+	reciprokeZ[i] = ray.reciproke.z;
+	min[i] = ray.min;
+	max[i] = ray.max;
+}
+
+dae::Ray dae::RayPacket::GetRay(uint32_t i) const
+{
+	return Ray{ origin, { directionX[i], directionY[i], directionZ[i] }, { reciprokeX[i], reciprokeY[i], reciprokeZ[i] }, min[i], max[i] };
+}
+
+void dae::ShadowRayPacket::SetRay(uint32_t i, const Ray& ray)
+{
+	rays[i] = ray;
+	length[i] = std::sqrt(ray.max);
+
+	//1 / -d is exactly -(1 / d), so the reversed ray needs no new divisions
+	reversed.SetRay(i, Ray{ reversed.origin, -ray.direction, -ray.reciproke, 0.f, ray.max });
+	reversed.rayMask |= 1u << i;
+}
+
+void dae::RayPacket::UpdateIntervals()
+{
+	minReciproke = { FLT_MAX, FLT_MAX, FLT_MAX };
+	maxReciproke = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	hasIntervals = rayMask != 0;
+
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+		const Vector3 reciproke{ reciprokeX[i], reciprokeY[i], reciprokeZ[i] };
+
+		//axis aligned directions have infinite reciprocals, their products with the box would turn into NaNs
+		if (!std::isfinite(reciproke.x) || !std::isfinite(reciproke.y) || !std::isfinite(reciproke.z)) hasIntervals = false;
+
+		minReciproke = Vector3::Min(minReciproke, reciproke);
+		maxReciproke = Vector3::Max(maxReciproke, reciproke);
+	}
+
+	//an interval straddling 0 holds every reciprocal beyond its ends, it can't bound the rays
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (minReciproke[axis] < 0 && maxReciproke[axis] > 0) hasIntervals = false;
+	}
+}
+
+uint32_t dae::RayPacket::IntersectBounds(const AABB& bounds, uint32_t rayMask, const float* tClosest, float& entry) const
+{
+	const Vector3 toMin{ bounds.minAABB - origin };
+	const Vector3 toMax{ bounds.maxAABB - origin };
+
+	if (hasIntervals)
+	{
+		//interval arithmetic: the earliest entry and latest exit any ray of the packet can have, per axis
+		//positive directions enter through the min plane, negative ones through the max plane
+		const auto axisNear = [](float toMin, float toMax, float minReciproke, float maxReciproke)
+		{
+			const float toNear{ minReciproke > 0 ? toMin : toMax };
+			return std::min(toNear * minReciproke, toNear * maxReciproke);
+		};
+		const auto axisFar = [](float toMin, float toMax, float minReciproke, float maxReciproke)
+		{
+			const float toFar{ minReciproke > 0 ? toMax : toMin };
+			return std::max(toFar * minReciproke, toFar * maxReciproke);
+		};
+
+		const float tNear{ std::max(std::max(
+			axisNear(toMin.x, toMax.x, minReciproke.x, maxReciproke.x),
+			axisNear(toMin.y, toMax.y, minReciproke.y, maxReciproke.y)),
+			axisNear(toMin.z, toMax.z, minReciproke.z, maxReciproke.z)) };
+		const float tFar{ std::min(std::min(
+			axisFar(toMin.x, toMax.x, minReciproke.x, maxReciproke.x),
+			axisFar(toMin.y, toMax.y, minReciproke.y, maxReciproke.y)),
+			axisFar(toMin.z, toMax.z, minReciproke.z, maxReciproke.z)) };
+
+		if (tNear > tFar || tFar <= 0) return 0;
+	}
+
+	uint32_t hitMask{ 0 };
+	alignas(32) float tMin[Size];
+
+#if defined(DAE_SIMD_SSE)
+#if defined(DAE_SIMD_AVX)
+	constexpr uint32_t Lanes{ 8 };
+#else
+	constexpr uint32_t Lanes{ 4 };
+#endif
+	for (uint32_t i = 0; i < Size; i += Lanes)
+	{
+		const uint32_t laneMask{ (rayMask >> i) & ((1u << Lanes) - 1) };
+		if (laneMask == 0) continue;
+
+#if defined(DAE_SIMD_AVX)
+		const __m256 tx1 = _mm256_mul_ps(_mm256_set1_ps(toMin.x), _mm256_load_ps(reciprokeX + i));
+		const __m256 tx2 = _mm256_mul_ps(_mm256_set1_ps(toMax.x), _mm256_load_ps(reciprokeX + i));
+		const __m256 ty1 = _mm256_mul_ps(_mm256_set1_ps(toMin.y), _mm256_load_ps(reciprokeY + i));
+		const __m256 ty2 = _mm256_mul_ps(_mm256_set1_ps(toMax.y), _mm256_load_ps(reciprokeY + i));
+		const __m256 tz1 = _mm256_mul_ps(_mm256_set1_ps(toMin.z), _mm256_load_ps(reciprokeZ + i));
+		const __m256 tz2 = _mm256_mul_ps(_mm256_set1_ps(toMax.z), _mm256_load_ps(reciprokeZ + i));
+
+		const __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+		const __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+		const __m256 hit = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ)),
+			_mm256_cmp_ps(tmin, _mm256_loadu_ps(tClosest + i), _CMP_LT_OQ));
+
+		_mm256_store_ps(tMin + i, tmin);
+		hitMask |= (static_cast<uint32_t>(_mm256_movemask_ps(hit)) & laneMask) << i;
+#else
+		const __m128 tx1 = _mm_mul_ps(_mm_set1_ps(toMin.x), _mm_load_ps(reciprokeX + i));
+		const __m128 tx2 = _mm_mul_ps(_mm_set1_ps(toMax.x), _mm_load_ps(reciprokeX + i));
+		const __m128 ty1 = _mm_mul_ps(_mm_set1_ps(toMin.y), _mm_load_ps(reciprokeY + i));
+		const __m128 ty2 = _mm_mul_ps(_mm_set1_ps(toMax.y), _mm_load_ps(reciprokeY + i));
+		const __m128 tz1 = _mm_mul_ps(_mm_set1_ps(toMin.z), _mm_load_ps(reciprokeZ + i));
+		const __m128 tz2 = _mm_mul_ps(_mm_set1_ps(toMax.z), _mm_load_ps(reciprokeZ + i));
+
+		const __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+		const __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+		const __m128 hit = _mm_and_ps(
+			_mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpgt_ps(tmax, _mm_setzero_ps())),
+			_mm_cmplt_ps(tmin, _mm_loadu_ps(tClosest + i)));
+
+		_mm_store_ps(tMin + i, tmin);
+		hitMask |= (static_cast<uint32_t>(_mm_movemask_ps(hit)) & laneMask) << i;
+#endif
+	}
+#else
+	for (uint32_t mask = rayMask; mask; mask &= mask - 1)
+	{
+		const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+
+		const float tx1{ toMin.x * reciprokeX[i] }, tx2{ toMax.x * reciprokeX[i] };
+		const float ty1{ toMin.y * reciprokeY[i] }, ty2{ toMax.y * reciprokeY[i] };
+		const float tz1{ toMin.z * reciprokeZ[i] }, tz2{ toMax.z * reciprokeZ[i] };
+
+		tMin[i] = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+		const float tmax{ std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2)) };
+
+		if (tmax >= tMin[i] && tmax > 0 && tMin[i] < tClosest[i]) hitMask |= 1u << i;
+	}
+#endif
+
+	entry = FLT_MAX;
+	for (uint32_t mask = hitMask; mask; mask &= mask - 1)
+	{
+		entry = std::min(entry, tMin[std::countr_zero(mask)]);
+	}
+
+	return hitMask;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	//Square block of camera rays traced together, every ray starts at the shared origin
+	//Directions are stored per axis (SoA) so box and triangle tests run over several rays at once
+	struct alignas(32) RayPacket
+	{
+		static constexpr uint32_t Width{ 4 }; //rays per side of the pixel block
+		static constexpr uint32_t Size{ Width * Width };
+
+		//the arrays come first so every one of them starts on a SIMD register boundary
+		float directionX[Size]{}, directionY[Size]{}, directionZ[Size]{};
+		float reciprokeX[Size]{}, reciprokeY[Size]{}, reciprokeZ[Size]{};
+		float min[Size]{}, max[Size]{};
+
+		Vector3 origin{};
+
+		//Bit i is set when slot i holds a ray, blocks cut off by the frame border leave bits clear
+		uint32_t rayMask{ 0 };
+
+		//Stores everything but the origin, ray.origin has to match the packet origin
+		void SetRay(uint32_t i, const Ray& ray);
+		Ray GetRay(uint32_t i) const;
+
+		//Spans the reciprocal directions of the rays in rayMask, call once all rays are set
+		void UpdateIntervals();
+
+		/**
+		 * \brief Slab test of the rays in rayMask against a box, packets missing it as a whole are culled by one interval test first
+		 * \param tClosest per ray, boxes starting beyond it are missed
+		 * \param entry receives the nearest entry distance of the hit rays, used to sort children
+		 * \return mask of the rays hitting the box
+		 */
+		uint32_t IntersectBounds(const AABB& bounds, uint32_t rayMask, const float* tClosest, float& entry) const;
+
+		//Reciprocal directions of all rays lie in [minReciproke, maxReciproke], only set when no axis changes sign within the packet
+		Vector3 minReciproke{};
+		Vector3 maxReciproke{};
+		bool hasIntervals{ false };
+	};
+
+	//Shadow rays from up to RayPacket::Size surface points to one shared endpoint, the light
+	//Boxes are culled with the rays reversed, they then all start at the endpoint and make a regular packet,
+	//primitives are still tested with the surface to light rays so every ray keeps its exact result
+	struct ShadowRayPacket
+	{
+		RayPacket reversed{};
+		Ray rays[RayPacket::Size]{};
+		float length[RayPacket::Size]{}; //distance from the ray origin to the endpoint, bounds the reversed rays
+
+		//Sets the endpoint every ray added after this runs to
+		void SetEndpoint(const Vector3& endpoint) { reversed.origin = endpoint; }
+		//ray.max holds the squared distance to the endpoint, like the shadow rays the renderer builds
+		//Call reversed.UpdateIntervals once all rays are set
+		void SetRay(uint32_t i, const Ray& ray);
+		uint32_t GetRayMask() const { return reversed.rayMask; }
+	};
+}
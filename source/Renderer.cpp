@@ -1,127 +1,318 @@
-//External includes
-#include "SDL.h"
-#include "SDL_surface.h"
-
 //Project includes
 #include "Renderer.h"
+#include "FrameBuffer.h"
+#include "TileScheduler.h"
 #include "Math.h"
 #include "Matrix.h"
 #include "Material.h"
 #include "Scene.h"
 #include "Utils.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
 
 #include <iostream>
 #include <algorithm>
-#include <thread> 
-#include <future> //async stuff
-#include <ppl.h>
+#include <bit>
+#include <type_traits>
 
 using namespace dae;
 
-//#define ASYNC
-#define PARALLEL_FOR
+#define TILED
 
 Renderer::Renderer(SDL_Window * pWindow) :
-	m_pWindow(pWindow),
-	m_pBuffer(SDL_GetWindowSurface(pWindow))
+	m_pFrameBuffer(new WindowFrameBuffer(pWindow)),
+	m_pTileScheduler(new TileScheduler(ThreadPool::Get()))
+{
+	//Initialize
+	m_Width = m_pFrameBuffer->GetWidth();
+	m_Height = m_pFrameBuffer->GetHeight();
+	m_pBufferPixels = m_pFrameBuffer->GetPixels();
+	m_pTileScheduler->SetFrameSize(m_Width, m_Height);
+}
+
+Renderer::Renderer(int width, int height) :
+	m_pFrameBuffer(new OffscreenFrameBuffer(width, height)),
+	m_pTileScheduler(new TileScheduler(ThreadPool::Get()))
 {
 	//Initialize
-	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
-	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	m_Width = m_pFrameBuffer->GetWidth();
+	m_Height = m_pFrameBuffer->GetHeight();
+	m_pBufferPixels = m_pFrameBuffer->GetPixels();
+	m_pTileScheduler->SetFrameSize(m_Width, m_Height);
+}
+
+Renderer::~Renderer()
+{
+	delete m_pTileScheduler;
+	m_pTileScheduler = nullptr;
+
+	delete m_pFrameBuffer;
+	m_pFrameBuffer = nullptr;
 }
 
 
 
+template<typename Kernel>
+void Renderer::DispatchLightingMode(Kernel&& kernel) const
+{
+	//the mode and shadow state are passed as types, so the kernel can use them as template arguments
+	const auto dispatchShadows = [&](auto mode)
+	{
+		if (m_ShadowsEnabled) kernel(mode, std::true_type{});
+		else kernel(mode, std::false_type{});
+	};
+
+	switch (m_CurrentLightingMode)
+	{
+	case LightingMode::ObservedArea:
+		dispatchShadows(std::integral_constant<LightingMode, LightingMode::ObservedArea>{});
+		break;
+	case LightingMode::Radiance:
+		dispatchShadows(std::integral_constant<LightingMode, LightingMode::Radiance>{});
+		break;
+	case LightingMode::BRDF:
+		dispatchShadows(std::integral_constant<LightingMode, LightingMode::BRDF>{});
+		break;
+	case LightingMode::Combined:
+	default:
+		dispatchShadows(std::integral_constant<LightingMode, LightingMode::Combined>{});
+		break;
+	}
+}
+
 void Renderer::Render(Scene* pScene) const
 {
 	Camera& camera = pScene->GetCamera();
 	camera.CalculateCameraToWorld();
 
-	const auto& materials = pScene->GetMaterials();
+	//picks up the objects moved by this frame's scene update
+	pScene->UpdateTLAS();
+
+	const MaterialTable& materials = pScene->GetMaterialTable();
 	const auto& lights = pScene->GetLights();
 
 	const float FOV{ tan((TO_RADIANS * camera.fovAngle) / 2.f) };
 	const float aspectRatio{ static_cast<float>(m_Width) / m_Height };
 
 
-	const uint32_t numPixels = m_Width * m_Height;
-
-#if defined(ASYNC)
-	//async logic
+#if defined(TILED) //workers pull cache line sized tiles in Morton order
+	//tiled logic
 	//..
-	const uint32_t numCores = std::thread::hardware_concurrency();
-	std::vector<std::future<void>> async_futures{};
+	DispatchLightingMode([&, this](auto mode, auto shadowsEnabled)
+	{
+		constexpr LightingMode Mode{ decltype(mode)::value };
+		constexpr bool ShadowsEnabled{ decltype(shadowsEnabled)::value };
+
+		m_pTileScheduler->Run([&, this](const Tile& tile)
+		{
+			RenderTile<Mode, ShadowsEnabled>(pScene, tile, FOV, aspectRatio, camera, lights, materials);
+		});
+	});
 
-	const uint32_t numPixelsPerTask = numPixels / numCores;
-	uint32_t numUnassignedPixels = numPixels % numCores;
-	uint32_t currPixelIndex{ 0 };
 
-	for(uint32_t coreID{0}; coreID < numCores; ++coreID)
+#else
+	//synchronous logic
+	//..
+	const uint32_t numPixels = m_Width * m_Height;
+	DispatchLightingMode([&, this](auto mode, auto shadowsEnabled)
 	{
-		uint32_t taskSize{ numPixelsPerTask };
+		constexpr LightingMode Mode{ decltype(mode)::value };
+		constexpr bool ShadowsEnabled{ decltype(shadowsEnabled)::value };
 
-		if(numUnassignedPixels > 0)
+		for (uint32_t i{ 0 }; i < numPixels; ++i)
 		{
-			++taskSize;
-			--numUnassignedPixels;
+			RenderPixel<Mode, ShadowsEnabled>(pScene, i, FOV, aspectRatio, camera, lights, materials);
 		}
+	});
+
+#endif
+	
+
+	//@END
+	//Present the frame (no-op when rendering headless)
+	m_pFrameBuffer->Present();
+}
+
 
-		async_futures.push_back(
-			std::async(std::launch::async, [=, this]
+
+template<Renderer::LightingMode Mode, bool ShadowsEnabled>
+void Renderer::RenderTile(Scene* pScene, const Tile& tile, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const MaterialTable& materials) const
+{
+	const uint32_t endY{ tile.y + tile.height };
+	const uint32_t endX{ tile.x + tile.width };
+
+	//pixel (x, y) of the tile is stored at x + y * TileSize
+	constexpr uint32_t TileSize{ TileScheduler::TileSize };
+	HitRecord closestHits[TileSize * TileSize]{};
+	Vector3 viewDirections[TileSize * TileSize]{};
+	ColorRGB colors[TileSize * TileSize]{};
+
+	const auto getTileIndex = [&tile](uint32_t px, uint32_t py) { return (px - tile.x) + (py - tile.y) * TileSize; };
+
+	//camera rays are traced in square packets
+	for (uint32_t packetY{ tile.y }; packetY < endY; packetY += RayPacket::Width)
+	{
+		for (uint32_t packetX{ tile.x }; packetX < endX; packetX += RayPacket::Width)
+		{
+			RayPacket packet{};
+			packet.origin = camera.origin;
+
+			for (uint32_t y{ 0 }; y < RayPacket::Width; ++y)
+			{
+				for (uint32_t x{ 0 }; x < RayPacket::Width; ++x)
 				{
-					const uint32_t pixelIndexEnd = currPixelIndex + taskSize;
+					//tiles cut off by the frame border leave the slots outside of it empty
+					if (packetX + x >= endX || packetY + y >= endY) continue;
 
-					for(uint32_t pixelIndex{currPixelIndex}; pixelIndex < pixelIndexEnd; ++pixelIndex)
-					{
-						RenderPixel(pScene, pixelIndex, FOV, aspectRatio, camera, lights, materials);
-					}
-				})
-		);
+					const uint32_t slot{ x + y * RayPacket::Width };
+					packet.SetRay(slot, CreateViewRay(packetX + x, packetY + y, fov, aspectRatio, camera));
+					packet.rayMask |= 1u << slot;
+				}
+			}
+			packet.UpdateIntervals();
 
-		currPixelIndex += taskSize;
+			HitRecord packetHits[RayPacket::Size]{};
+			pScene->GetClosestHits(packet, packetHits);
 
+			for (uint32_t mask{ packet.rayMask }; mask; mask &= mask - 1)
+			{
+				const uint32_t slot{ static_cast<uint32_t>(std::countr_zero(mask)) };
+				const uint32_t index{ getTileIndex(packetX + slot % RayPacket::Width, packetY + slot / RayPacket::Width) };
+				closestHits[index] = packetHits[slot];
+				viewDirections[index] = { packet.directionX[slot], packet.directionY[slot], packet.directionZ[slot] };
+			}
+		}
 	}
 
-	//Wait for all tasks
-	for(const std::future<void>& f : async_futures)
+	//the hits are shaded grouped by material, so every material's BRDF runs over one contiguous batch
+	//sort keys hold the material index above the tile index, the hits of a material stay in tile order
+	uint32_t shadingOrder[TileSize * TileSize];
+	uint32_t hitCount{ 0 };
+	for (uint32_t py{ tile.y }; py < endY; ++py)
 	{
-		f.wait();
+		for (uint32_t px{ tile.x }; px < endX; ++px)
+		{
+			const uint32_t index{ getTileIndex(px, py) };
+			if (closestHits[index].didHit) shadingOrder[hitCount++] = static_cast<uint32_t>(closestHits[index].materialIndex) << 16 | index;
+		}
 	}
+	std::sort(shadingOrder, shadingOrder + hitCount);
 
+	bool isLit[TileSize * TileSize]{};
+	Vector3 directionsToLight[TileSize * TileSize]{};
 
-#elif defined(PARALLEL_FOR) //system chooses what happens together
-	//parallel for logic
-	//..
-	concurrency::parallel_for(0u, numPixels, [=, this](int i)
+	//the lit hits of a material batch, their BRDFs are evaluated SIMD::NativeWidth at a time
+	static_assert(TileSize * TileSize <= ShadingBatch::MaxSize);
+	ShadingBatch shadingBatch{};
+	shadingBatch.useLookupTables = m_UseLookupTables;
+	ShadingResults shadingResults{};
+	uint32_t batchIndices[TileSize * TileSize];
+
+	//then light by light, the shadow rays of a packet's hits all end in the light so they are traced as a packet too
+	//lights are added in scene order, the same order ShadePixel sums them in
+	for (const Light& light : lights)
 	{
-			RenderPixel(pScene, i, FOV, aspectRatio, camera, lights, materials);
-	});
+		for (uint32_t packetY{ tile.y }; packetY < endY; packetY += RayPacket::Width)
+		{
+			for (uint32_t packetX{ tile.x }; packetX < endX; packetX += RayPacket::Width)
+			{
+				ShadowRayPacket packet{};
+				packet.SetEndpoint(light.origin);
 
+				for (uint32_t y{ 0 }; y < RayPacket::Width; ++y)
+				{
+					for (uint32_t x{ 0 }; x < RayPacket::Width; ++x)
+					{
+						if (packetX + x >= endX || packetY + y >= endY) continue;
 
-#else
-	//synchronous logic
-	//..
-	for(uint32_t i{0}; i< numPixels; ++i)
+						const HitRecord& closestHit = closestHits[getTileIndex(packetX + x, packetY + y)];
+						if (closestHit.didHit) packet.SetRay(x + y * RayPacket::Width, CreateShadowRay(light, closestHit));
+					}
+				}
+
+				const uint32_t rayMask{ packet.GetRayMask() };
+				if (rayMask == 0) continue;
+
+				uint32_t visibleMask{ rayMask };
+				if constexpr (ShadowsEnabled)
+				{
+					packet.reversed.UpdateIntervals();
+					visibleMask &= ~pScene->GetOccludedMask(packet);
+				}
+
+				for (uint32_t mask{ rayMask }; mask; mask &= mask - 1)
+				{
+					const uint32_t slot{ static_cast<uint32_t>(std::countr_zero(mask)) };
+					const uint32_t index{ getTileIndex(packetX + slot % RayPacket::Width, packetY + slot / RayPacket::Width) };
+					isLit[index] = (visibleMask >> slot) & 1u;
+					directionsToLight[index] = packet.rays[slot].direction;
+				}
+			}
+		}
+
+		for (uint32_t batchStart{ 0 }; batchStart < hitCount;)
+		{
+			const unsigned char materialIndex{ static_cast<unsigned char>(shadingOrder[batchStart] >> 16) };
+			uint32_t batchEnd{ batchStart + 1 };
+			while (batchEnd < hitCount && shadingOrder[batchEnd] >> 16 == materialIndex) ++batchEnd;
+
+			if constexpr (UsesBRDF(Mode))
+			{
+				shadingBatch.size = 0;
+				for (uint32_t i{ batchStart }; i < batchEnd; ++i)
+				{
+					const uint32_t index{ shadingOrder[i] & 0xFFFF };
+					if (isLit[index]) batchIndices[shadingBatch.Add(closestHits[index].normal, directionsToLight[index], -viewDirections[index])] = index;
+				}
+
+				materials.Visit(materialIndex, [&](const auto& material) { material.Shade(shadingBatch, shadingResults); });
+
+				for (uint32_t slot{ 0 }; slot < shadingBatch.size; ++slot)
+				{
+					const uint32_t index{ batchIndices[slot] };
+					colors[index] += ShadeLight<Mode>(light, closestHits[index], directionsToLight[index], shadingResults.Get(slot));
+				}
+			}
+			else
+			{
+				for (uint32_t i{ batchStart }; i < batchEnd; ++i)
+				{
+					const uint32_t index{ shadingOrder[i] & 0xFFFF };
+					if (isLit[index]) colors[index] += ShadeLight<Mode>(light, closestHits[index], directionsToLight[index], ColorRGB{});
+				}
+			}
+
+			batchStart = batchEnd;
+		}
+	}
+
+	for (uint32_t py{ tile.y }; py < endY; ++py)
 	{
-		RenderPixel(pScene, i, FOV, aspectRatio, camera, lights, materials);
+		for (uint32_t px{ tile.x }; px < endX; ++px)
+		{
+			WritePixel(px, py, colors[getTileIndex(px, py)]);
+		}
 	}
+}
 
-#endif
-	
+template<Renderer::LightingMode Mode, bool ShadowsEnabled>
+void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const MaterialTable& materials) const
+{
+	const uint32_t px { pixelIndex % m_Width };
+	const uint32_t py { pixelIndex / m_Width };
 
-	//@END
-	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
-}
+	const Ray viewRay{ CreateViewRay(px, py, fov, aspectRatio, camera) };
+	HitRecord closestHit{};
 
+	pScene->GetClosestHit(viewRay, closestHit);
 
+	ShadePixel<Mode, ShadowsEnabled>(pScene, px, py, viewRay, closestHit, lights, materials);
+}
 
-void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+Ray Renderer::CreateViewRay(uint32_t px, uint32_t py, float fov, float aspectRatio, const Camera& camera) const
 {
 	const float recipWidth{ 1.0f / m_Width };
 	const float recipHeight{ 1.0f / m_Height };
-	const uint32_t px { pixelIndex % m_Width };
-	const uint32_t py { pixelIndex / m_Width };
 
 	const float rx { px + .5f };
 	const float ry { py + .5f };
@@ -131,73 +322,95 @@ void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float
 	const float cx{ (2 * rxWidthRatio - 1) * aspectRatio * fov };
 	const float cy{ (1 - (2 * ry * recipHeight)) * fov };
 	
-	const Matrix camToWorld{ camera.cameraToWorld };
+	const Matrix& camToWorld{ camera.cameraToWorld };
 	Vector3 rayDirection{ cx,cy, 1 };
 
 	rayDirection = camToWorld.TransformVector(rayDirection).Normalized();
 	
-	const Ray viewRay{ camera.origin, rayDirection,{1 / rayDirection.x, 1 / rayDirection.y, 1 / rayDirection.z } };
-	ColorRGB finalColor{};
-	HitRecord closestHit{};
+	return Ray{ camera.origin, rayDirection,{1 / rayDirection.x, 1 / rayDirection.y, 1 / rayDirection.z } };
+}
 
-	pScene->GetClosestHit(viewRay, closestHit);
+template<Renderer::LightingMode Mode, bool ShadowsEnabled>
+void Renderer::ShadePixel(Scene* pScene, uint32_t px, uint32_t py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const MaterialTable& materials) const
+{
+	ColorRGB finalColor{};
 
 	if (closestHit.didHit) //FOR EACH PIXEL HIT BY OUR RAY
 	{
-		for (unsigned int i = 0; i < pScene->GetLights().size(); ++i) //FOR EACH LIGHT IN THE SCENE
+		//the material type is resolved once for all lights
+		materials.Visit(closestHit.materialIndex, [&](const auto& material)
 		{
-			Ray rayToLight{ };
-
-			rayToLight.origin = closestHit.origin + closestHit.normal * .01f;
-			rayToLight.direction = LightUtils::GetDirectionToLight(pScene->GetLights()[i], rayToLight.origin),
-			rayToLight.max = rayToLight.direction.SqrMagnitude();
-			rayToLight.direction.Normalize();
-			rayToLight.reciproke = { 1 / rayToLight.direction.x, 1 / rayToLight.direction.y, 1 / rayToLight.direction.z };
-
-			if (m_ShadowsEnabled && pScene->DoesHit(rayToLight)) //v
-				continue;
-
-
-			else //visible & unshadowed
+			for (const Light& light : lights) //FOR EACH LIGHT IN THE SCENE
 			{
-				const Light light{ pScene->GetLights()[i] };
-				float cosAngle{ Vector3::Dot(rayToLight.direction, closestHit.normal) };
-				if (cosAngle < 0) cosAngle = 0;
+				const Ray rayToLight{ CreateShadowRay(light, closestHit) };
 
-				switch (m_CurrentLightingMode)
+				if constexpr (ShadowsEnabled)
 				{
-				case dae::Renderer::LightingMode::ObservedArea:
-					finalColor += ColorRGB(1, 1, 1) * cosAngle;
-					break;
-				case dae::Renderer::LightingMode::Radiance:
-					finalColor += LightUtils::GetRadiance(light, closestHit.origin);
-					break;
-				case dae::Renderer::LightingMode::BRDF:
-					finalColor += materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -viewRay.direction);
-					break;
-				case dae::Renderer::LightingMode::Combined:
-					finalColor += LightUtils::GetRadiance(light, closestHit.origin) * materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -viewRay.direction) * cosAngle;
-					
+					if (pScene->DoesHit(rayToLight)) continue;
 				}
+
+				//visible & unshadowed
+				ColorRGB brdf{};
+				if constexpr (UsesBRDF(Mode)) brdf = material.Shade(closestHit, rayToLight.direction, -viewRay.direction);
+
+				finalColor += ShadeLight<Mode>(light, closestHit, rayToLight.direction, brdf);
 			}
-		}
+		});
+	}
 
-		
+	WritePixel(px, py, finalColor);
+}
+
+Ray Renderer::CreateShadowRay(const Light& light, const HitRecord& closestHit) const
+{
+	Ray rayToLight{ };
+
+	rayToLight.origin = closestHit.origin + closestHit.normal * .01f;
+	rayToLight.direction = LightUtils::GetDirectionToLight(light, rayToLight.origin),
+	rayToLight.max = rayToLight.direction.SqrMagnitude();
+	rayToLight.direction.Normalize();
+	rayToLight.reciproke = { 1 / rayToLight.direction.x, 1 / rayToLight.direction.y, 1 / rayToLight.direction.z };
+
+	return rayToLight;
+}
+
+template<Renderer::LightingMode Mode>
+ColorRGB Renderer::ShadeLight(const Light& light, const HitRecord& closestHit, const Vector3& directionToLight, const ColorRGB& brdf) const
+{
+	if constexpr (Mode == LightingMode::ObservedArea)
+	{
+		return ColorRGB(1, 1, 1) * std::max(Vector3::Dot(directionToLight, closestHit.normal), 0.f);
 	}
+	else if constexpr (Mode == LightingMode::Radiance)
+	{
+		return LightUtils::GetRadiance(light, closestHit.origin);
+	}
+	else if constexpr (Mode == LightingMode::BRDF)
+	{
+		return brdf;
+	}
+	else
+	{
+		const float cosAngle{ std::max(Vector3::Dot(directionToLight, closestHit.normal), 0.f) };
+		return LightUtils::GetRadiance(light, closestHit.origin) * brdf * cosAngle;
+	}
+}
 
+void Renderer::WritePixel(uint32_t px, uint32_t py, ColorRGB color) const
+{
 	//Update Color in Buffer
-	finalColor.MaxToOne();
+	color.MaxToOne();
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	m_pBufferPixels[px + (py * m_Width)] = m_pFrameBuffer->MapRGB(
+		static_cast<uint8_t>(color.r * 255),
+		static_cast<uint8_t>(color.g * 255),
+		static_cast<uint8_t>(color.b * 255));
 }
 
 
-bool Renderer::SaveBufferToImage() const
+bool Renderer::SaveBufferToImage(const std::string& filename) const
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+	return m_pFrameBuffer->SaveToImage(filename);
 }
 
 void dae::Renderer::CycleLightingMode()
@@ -1,10 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include <vector>
 
 struct SDL_Window;
-struct SDL_Surface;
 class Vector3;
 
 namespace dae
@@ -12,13 +12,21 @@ namespace dae
 	class Scene;
 	class Camera;
 	class Light;
-	class Material;
+	class MaterialTable;
+	class FrameBuffer;
+	class TileScheduler;
+	struct Tile;
+	struct Ray;
+	struct HitRecord;
+	struct Vector3;
+	struct ColorRGB;
 
 	class Renderer final
 	{
 	public:
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		Renderer(int width, int height); //Headless, renders to an offscreen buffer
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
@@ -27,19 +35,27 @@ namespace dae
 
 
 		void Render(Scene* pScene) const;
-		bool SaveBufferToImage() const;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		bool SaveBufferToImage(const std::string& filename = "RayTracing_Buffer.bmp") const;
+		Ray CreateViewRay(uint32_t px, uint32_t py, float fov, float aspectRatio, const Camera& camera) const;
+		//Ray from just above the hit surface to the light, its max is the squared distance to the light
+		Ray CreateShadowRay(const Light& light, const HitRecord& closestHit) const;
+		void WritePixel(uint32_t px, uint32_t py, ColorRGB color) const;
 
 
 		void CycleLightingMode();
 		void ToggleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; };
+		//Switches materials with lookup tables between exact and table shading
+		//The tables are up to 1% off and about 4x slower than the exact SIMD kernels, they only pay off against scalar shading
+		void ToggleLookupTables() { m_UseLookupTables = !m_UseLookupTables; };
 
-	private:
-		SDL_Window* m_pWindow{};
+		const FrameBuffer* GetFrameBuffer() const { return m_pFrameBuffer; }
 
-		SDL_Surface* m_pBuffer{};
+	private:
+		FrameBuffer* m_pFrameBuffer{};
 		uint32_t* m_pBufferPixels{};
 
+		TileScheduler* m_pTileScheduler{};
+
 		int m_Width{};
 		int m_Height{};
 
@@ -53,6 +69,23 @@ namespace dae
 		
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 		bool m_ShadowsEnabled{ true };
+		bool m_UseLookupTables{ false };
+
+		//The per pixel kernels are instantiated for every lighting mode and shadow state,
+		//Render picks one per frame so the light loops hold no mode branches
+		template<typename Kernel>
+		void DispatchLightingMode(Kernel&& kernel) const;
+
+		template<LightingMode Mode, bool ShadowsEnabled>
+		void RenderTile(Scene* pScene, const Tile& tile, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const MaterialTable& materials) const;
+		template<LightingMode Mode, bool ShadowsEnabled>
+		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const MaterialTable& materials) const;
+		template<LightingMode Mode, bool ShadowsEnabled>
+		void ShadePixel(Scene* pScene, uint32_t px, uint32_t py, const Ray& viewRay, const HitRecord& closestHit, const std::vector<Light>& lights, const MaterialTable& materials) const;
+		//Contribution of one unshadowed light, brdf is the material's BRDF for this light and only read by the modes that use it
+		template<LightingMode Mode>
+		ColorRGB ShadeLight(const Light& light, const HitRecord& closestHit, const Vector3& directionToLight, const ColorRGB& brdf) const;
+		static constexpr bool UsesBRDF(LightingMode mode) { return mode == LightingMode::BRDF || mode == LightingMode::Combined; }
 
 	};
 }
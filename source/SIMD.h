@@ -0,0 +1,209 @@
+#pragma once
+
+//Instruction sets the SIMD kernels can use, x64 always has SSE2, AVX needs /arch:AVX2 (or -mavx2)
+//Only the ReleaseAVX2 configuration passes /arch:AVX2, Debug and Release run every 8 wide kernel as SSE (BVH8 as two 4 wide halves)
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define DAE_SIMD_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(DAE_SIMD_SSE) && defined(__AVX2__)
+#define DAE_SIMD_AVX 1
+#endif
+
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+namespace dae
+{
+	namespace SIMD
+	{
+		//Number of floats processed per instruction by the widest enabled instruction set
+#if defined(DAE_SIMD_AVX)
+		constexpr uint32_t NativeWidth{ 8 };
+#elif defined(DAE_SIMD_SSE)
+		constexpr uint32_t NativeWidth{ 4 };
+#else
+		constexpr uint32_t NativeWidth{ 1 };
+#endif
+
+		//NativeWidth floats in one register, one lane per shading point of the batch kernels
+		//Without SIMD it holds a single float, the kernels then compile to the scalar code
+		struct FloatN
+		{
+#if defined(DAE_SIMD_AVX)
+			__m256 value;
+#elif defined(DAE_SIMD_SSE)
+			__m128 value;
+#else
+			float value;
+#endif
+		};
+
+#if defined(DAE_SIMD_AVX)
+		inline FloatN Broadcast(float f) { return { _mm256_set1_ps(f) }; }
+		//pFloats has to be aligned to 32 bytes
+		inline FloatN Load(const float* pFloats) { return { _mm256_load_ps(pFloats) }; }
+		inline void Store(float* pFloats, FloatN f) { _mm256_store_ps(pFloats, f.value); }
+
+		inline FloatN operator+(FloatN a, FloatN b) { return { _mm256_add_ps(a.value, b.value) }; }
+		inline FloatN operator-(FloatN a, FloatN b) { return { _mm256_sub_ps(a.value, b.value) }; }
+		inline FloatN operator*(FloatN a, FloatN b) { return { _mm256_mul_ps(a.value, b.value) }; }
+		inline FloatN operator/(FloatN a, FloatN b) { return { _mm256_div_ps(a.value, b.value) }; }
+		inline FloatN Min(FloatN a, FloatN b) { return { _mm256_min_ps(a.value, b.value) }; }
+		inline FloatN Max(FloatN a, FloatN b) { return { _mm256_max_ps(a.value, b.value) }; }
+		inline FloatN Sqrt(FloatN a) { return { _mm256_sqrt_ps(a.value) }; }
+
+		inline FloatN Less(FloatN a, FloatN b) { return { _mm256_cmp_ps(a.value, b.value, _CMP_LT_OQ) }; }
+		inline FloatN LessEqual(FloatN a, FloatN b) { return { _mm256_cmp_ps(a.value, b.value, _CMP_LE_OQ) }; }
+		inline FloatN GreaterEqual(FloatN a, FloatN b) { return { _mm256_cmp_ps(a.value, b.value, _CMP_GE_OQ) }; }
+		inline FloatN And(FloatN a, FloatN b) { return { _mm256_and_ps(a.value, b.value) }; }
+		inline uint32_t MoveMask(FloatN mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask.value)); }
+#elif defined(DAE_SIMD_SSE)
+		inline FloatN Broadcast(float f) { return { _mm_set1_ps(f) }; }
+		//pFloats has to be aligned to 16 bytes
+		inline FloatN Load(const float* pFloats) { return { _mm_load_ps(pFloats) }; }
+		inline void Store(float* pFloats, FloatN f) { _mm_store_ps(pFloats, f.value); }
+
+		inline FloatN operator+(FloatN a, FloatN b) { return { _mm_add_ps(a.value, b.value) }; }
+		inline FloatN operator-(FloatN a, FloatN b) { return { _mm_sub_ps(a.value, b.value) }; }
+		inline FloatN operator*(FloatN a, FloatN b) { return { _mm_mul_ps(a.value, b.value) }; }
+		inline FloatN operator/(FloatN a, FloatN b) { return { _mm_div_ps(a.value, b.value) }; }
+		inline FloatN Min(FloatN a, FloatN b) { return { _mm_min_ps(a.value, b.value) }; }
+		inline FloatN Max(FloatN a, FloatN b) { return { _mm_max_ps(a.value, b.value) }; }
+		inline FloatN Sqrt(FloatN a) { return { _mm_sqrt_ps(a.value) }; }
+
+		inline FloatN Less(FloatN a, FloatN b) { return { _mm_cmplt_ps(a.value, b.value) }; }
+		inline FloatN LessEqual(FloatN a, FloatN b) { return { _mm_cmple_ps(a.value, b.value) }; }
+		inline FloatN GreaterEqual(FloatN a, FloatN b) { return { _mm_cmpge_ps(a.value, b.value) }; }
+		inline FloatN And(FloatN a, FloatN b) { return { _mm_and_ps(a.value, b.value) }; }
+		inline uint32_t MoveMask(FloatN mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask.value)); }
+#else
+		inline FloatN Broadcast(float f) { return { f }; }
+		inline FloatN Load(const float* pFloats) { return { *pFloats }; }
+		inline void Store(float* pFloats, FloatN f) { *pFloats = f.value; }
+
+		inline FloatN operator+(FloatN a, FloatN b) { return { a.value + b.value }; }
+		inline FloatN operator-(FloatN a, FloatN b) { return { a.value - b.value }; }
+		inline FloatN operator*(FloatN a, FloatN b) { return { a.value * b.value }; }
+		inline FloatN operator/(FloatN a, FloatN b) { return { a.value / b.value }; }
+		inline FloatN Min(FloatN a, FloatN b) { return { a.value < b.value ? a.value : b.value }; }
+		inline FloatN Max(FloatN a, FloatN b) { return { a.value > b.value ? a.value : b.value }; }
+		inline FloatN Sqrt(FloatN a) { return { std::sqrt(a.value) }; }
+
+		//masks have all bits set in the lanes where the comparison holds, like the SIMD compare instructions
+		inline FloatN ToMask(bool condition) { return { std::bit_cast<float>(condition ? ~0u : 0u) }; }
+		inline FloatN Less(FloatN a, FloatN b) { return ToMask(a.value < b.value); }
+		inline FloatN LessEqual(FloatN a, FloatN b) { return ToMask(a.value <= b.value); }
+		inline FloatN GreaterEqual(FloatN a, FloatN b) { return ToMask(a.value >= b.value); }
+		inline FloatN And(FloatN a, FloatN b) { return { std::bit_cast<float>(std::bit_cast<uint32_t>(a.value) & std::bit_cast<uint32_t>(b.value)) }; }
+		inline uint32_t MoveMask(FloatN mask) { return std::bit_cast<uint32_t>(mask.value) >> 31; }
+#endif
+
+		//x to the power of an integer, by repeated squaring: no more than 2 * log2(exponent) multiplications
+		inline FloatN PowInteger(FloatN x, uint32_t exponent)
+		{
+			FloatN result{ Broadcast(1.f) };
+			for (; exponent; exponent >>= 1)
+			{
+				if (exponent & 1u) result = result * x;
+				x = x * x;
+			}
+			return result;
+		}
+
+		//log2(x) for positive, normal x: the exponent bits plus a polynomial in the mantissa (Cephes logf), error below 2e-7 absolute
+		inline FloatN Log2(FloatN x)
+		{
+#if defined(DAE_SIMD_SSE)
+#if defined(DAE_SIMD_AVX)
+			const __m256i bits{ _mm256_castps_si256(x.value) };
+			FloatN exponent{ _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127))) };
+			FloatN mantissa{ _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000))) };
+
+			//mantissas above sqrt(2) are halved, the polynomial then only has to cover [sqrt(2) / 2, sqrt(2)]
+			const __m256 isLarge{ _mm256_cmp_ps(mantissa.value, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ) };
+			mantissa = { _mm256_blendv_ps(mantissa.value, _mm256_mul_ps(mantissa.value, _mm256_set1_ps(.5f)), isLarge) };
+			exponent = { _mm256_add_ps(exponent.value, _mm256_and_ps(isLarge, _mm256_set1_ps(1.f))) };
+#else
+			const __m128i bits{ _mm_castps_si128(x.value) };
+			FloatN exponent{ _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127))) };
+			FloatN mantissa{ _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000))) };
+
+			//mantissas above sqrt(2) are halved, the polynomial then only has to cover [sqrt(2) / 2, sqrt(2)]
+			const __m128 isLarge{ _mm_cmpgt_ps(mantissa.value, _mm_set1_ps(1.41421356f)) };
+			mantissa = { _mm_or_ps(_mm_and_ps(isLarge, _mm_mul_ps(mantissa.value, _mm_set1_ps(.5f))), _mm_andnot_ps(isLarge, mantissa.value)) };
+			exponent = { _mm_add_ps(exponent.value, _mm_and_ps(isLarge, _mm_set1_ps(1.f))) };
+#endif
+			const FloatN f{ mantissa - Broadcast(1.f) };
+			const FloatN f2{ f * f };
+
+			FloatN polynomial{ Broadcast(7.0376836292e-2f) };
+			polynomial = polynomial * f + Broadcast(-1.1514610310e-1f);
+			polynomial = polynomial * f + Broadcast(1.1676998740e-1f);
+			polynomial = polynomial * f + Broadcast(-1.2420140846e-1f);
+			polynomial = polynomial * f + Broadcast(1.4249322787e-1f);
+			polynomial = polynomial * f + Broadcast(-1.6668057665e-1f);
+			polynomial = polynomial * f + Broadcast(2.0000714765e-1f);
+			polynomial = polynomial * f + Broadcast(-2.4999993993e-1f);
+			polynomial = polynomial * f + Broadcast(3.3333331174e-1f);
+
+			//ln(1 + f)
+			const FloatN logarithm{ f + polynomial * f * f2 - Broadcast(.5f) * f2 };
+			return logarithm * Broadcast(1.44269504f) + exponent;
+#else
+			return { std::log2(x.value) };
+#endif
+		}
+
+		//2^x, the rounded part of x goes into the exponent bits, a polynomial covers the rest (Cephes exp2f), relative error below 2e-7
+		//x is clamped to [-126, 126], the range of normal floats
+		inline FloatN Exp2(FloatN x)
+		{
+#if defined(DAE_SIMD_SSE)
+			x = Min(Max(x, Broadcast(-126.f)), Broadcast(126.f));
+#if defined(DAE_SIMD_AVX)
+			const __m256i rounded{ _mm256_cvtps_epi32(x.value) };
+			const FloatN f{ x - FloatN{ _mm256_cvtepi32_ps(rounded) } };
+			const FloatN scale{ _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(rounded, _mm256_set1_epi32(127)), 23)) };
+#else
+			const __m128i rounded{ _mm_cvtps_epi32(x.value) };
+			const FloatN f{ x - FloatN{ _mm_cvtepi32_ps(rounded) } };
+			const FloatN scale{ _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(rounded, _mm_set1_epi32(127)), 23)) };
+#endif
+			FloatN polynomial{ Broadcast(1.535336188319500e-4f) };
+			polynomial = polynomial * f + Broadcast(1.339887440266574e-3f);
+			polynomial = polynomial * f + Broadcast(9.618437357674640e-3f);
+			polynomial = polynomial * f + Broadcast(5.550332471162809e-2f);
+			polynomial = polynomial * f + Broadcast(2.402264791363012e-1f);
+			polynomial = polynomial * f + Broadcast(6.931472028550421e-1f);
+
+			return (polynomial * f + Broadcast(1.f)) * scale;
+#else
+			return { std::exp2(x.value) };
+#endif
+		}
+
+		//x^exponent for x >= 0 and exponent > 0, integer exponents up to 64 are computed by multiplication, relative error below 1e-7 * exponent
+		//otherwise as 2^(exponent * log2(x)), relative error below 3e-7 * (1 + |exponent * log2(x)|) as the Log2 error is scaled by the exponent
+		//SelfTest checks both bounds
+		inline FloatN Pow(FloatN x, float exponent)
+		{
+			if (exponent >= 0.f && exponent <= 64.f && exponent == std::floor(exponent)) return PowInteger(x, static_cast<uint32_t>(exponent));
+
+#if defined(DAE_SIMD_SSE)
+			//log2 of 0 is -inf, such lanes are forced to 0 once the power is computed
+			const FloatN power{ Exp2(Broadcast(exponent) * Log2(Max(x, Broadcast(FLT_MIN)))) };
+#if defined(DAE_SIMD_AVX)
+			return { _mm256_and_ps(power.value, _mm256_cmp_ps(x.value, _mm256_setzero_ps(), _CMP_GT_OQ)) };
+#else
+			return { _mm_and_ps(power.value, _mm_cmpgt_ps(x.value, _mm_setzero_ps())) };
+#endif
+#else
+			return { std::pow(x.value, exponent) };
+#endif
+		}
+	}
+}
@@ -2,6 +2,9 @@
 #include "Utils.h"
 #include "Material.h"
 #include "BVH.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
+#include <bit>
 #include <iostream>
 
 namespace dae {
@@ -13,8 +16,10 @@ namespace dae {
 	{
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
-		m_TriangleMeshGeometries.reserve(32);
+		m_Instances.reserve(32);
 		m_Lights.reserve(32);
+
+		m_MaterialTable.Add(*m_Materials[0]);
 	}
 
 	Scene::~Scene()
@@ -26,79 +31,88 @@ namespace dae {
 		}
 
 		m_Materials.clear();
+
+		for (auto& pBVH : m_BoundingVolumeHierarchies)
+		{
+			delete pBVH;
+			pBVH = nullptr;
+		}
+
+		m_BoundingVolumeHierarchies.clear();
 	}
 
 	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) 
 	{
-		HitRecord testHit{};
-		testHit.t = FLT_MAX;
-		for (unsigned int i = 0; i < m_SphereGeometries.size(); i++)
-		{
-			GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray, testHit);
-			if (testHit.t < closestHit.t)
-			{
-				closestHit = testHit;
-			}
-		}
+		m_PlaneSet.HitTest(ray, closestHit);
 
-		for (unsigned int i = 0; i < m_PlaneGeometries.size(); i++)
-		{
-			GeometryUtils::HitTest_Plane(m_PlaneGeometries[i], ray, testHit);
-			if (testHit.t < closestHit.t)
-			{
-				closestHit = testHit;
-			}
-		}
+		//objects behind the closest plane hit are culled by the traversal
+		m_TLAS.GetClosestHit(ray, closestHit);
+	}
 
-		for (unsigned int i = 0; i < m_BoundingVolumeHierarchies.size(); ++i)
+	void Scene::GetClosestHits(const RayPacket& packet, HitRecord* hitRecords)
+	{
+		for (uint32_t mask = packet.rayMask; mask; mask &= mask - 1)
 		{
-			GeometryUtils::HitTest_BVH(m_BoundingVolumeHierarchies[i], ray, testHit);
-			if (testHit.t < closestHit.t)
-			{
-				closestHit = testHit;
-			}
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+			m_PlaneSet.HitTest(packet.GetRay(i), hitRecords[i]);
 		}
 
-		for (unsigned int i = 0; i < m_TriangleMeshGeometries.size(); ++i)
-		{
-			GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, testHit);
-			if (testHit.t < closestHit.t)
-			{
-				closestHit = testHit;
-			}
-		}
+		m_TLAS.GetClosestHits(packet, hitRecords);
 	}
 
 	bool Scene::DoesHit(const Ray& ray) 
 	{
-		HitRecord testHit{};
-		for (unsigned int i = 0; i < m_SphereGeometries.size(); i++)
-		{
-			GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray, testHit);
-			if (testHit.didHit) return true;
+		if (m_PlaneSet.DoesHit(ray)) return true;
 
-		}
+		return m_TLAS.DoesHit(ray);
+	}
 
-		for (unsigned int i = 0; i < m_PlaneGeometries.size(); i++)
-		{
-			GeometryUtils::HitTest_Plane(m_PlaneGeometries[i], ray, testHit);
-			if (testHit.didHit) return true;
-		}
+	uint32_t Scene::GetOccludedMask(const ShadowRayPacket& packet)
+	{
+		const uint32_t rayMask{ packet.GetRayMask() };
+		uint32_t occludedMask{ 0 };
 
-		for (unsigned int i = 0; i < m_BoundingVolumeHierarchies.size(); i++)
+		//same plane tests as DoesHit, the rays blocked by a plane skip the TLAS
+		for (uint32_t mask = rayMask; mask; mask &= mask - 1)
 		{
-			GeometryUtils::HitTest_BVH(m_BoundingVolumeHierarchies[i], ray, testHit);
-			if (testHit.didHit) return true;
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+			if (m_PlaneSet.DoesHit(packet.rays[i])) occludedMask |= 1u << i;
 		}
 
+		if (occludedMask == rayMask) return occludedMask;
+		return occludedMask | m_TLAS.GetOccludedMask(packet, rayMask & ~occludedMask);
+	}
+
+	void Scene::UpdateTLAS()
+	{
+		//rebuilding millions of spheres every frame would cost more than tracing them, static ones keep their tree
+		if (m_RebuildSpheres) m_SphereSet.Build(m_SphereGeometries);
+		else if (m_RefitSpheres) m_SphereSet.Refit(m_SphereGeometries);
+		m_RebuildSpheres = m_RefitSpheres = false;
+
+		m_PlaneSet.Build(m_PlaneGeometries);
 
-		for (unsigned int i = 0; i < m_TriangleMeshGeometries.size(); i++)
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, testHit);
-			if (testHit.didHit) return true;
+			if (mesh.pBVH)
+			{
+				if (mesh.transformsChanged) mesh.pBVH->Update();
+			}
+			else if (mesh.indices.size() / 3 > m_MeshBVHFaceThreshold)
+			{
+				//built here rather than in AddTriangleMesh, the scenes fill their meshes after adding them
+				BVHBuildSettings settings{ m_MeshBVHSettings };
+				settings.objectSpace = false;
+				//world space positions depend on when the mesh is first seen, a cached tree would never be loaded again
+				settings.cacheDirectory.clear();
+				mesh.pBVH = AddBVH(mesh, settings);
+				mesh.UpdatePackedTriangles();
+			}
+
+			mesh.transformsChanged = false;
 		}
 
-		return false;
+		m_TLAS.Build(m_SphereSet, m_TriangleMeshGeometries, m_BoundingVolumeHierarchies, m_Instances);
 	}
 
 #pragma region Scene Helpers
@@ -110,6 +124,7 @@ namespace dae {
 		s.materialIndex = materialIndex;
 
 		m_SphereGeometries.emplace_back(s);
+		m_RebuildSpheres = true;
 		return &m_SphereGeometries.back();
 	}
 
@@ -134,12 +149,17 @@ namespace dae {
 		return &m_TriangleMeshGeometries.back();
 	}
 
-	BVH* Scene::AddBVH(TriangleMesh& mesh)
+	BVH* Scene::AddBVH(TriangleMesh& mesh, const BVHBuildSettings& settings)
 	{
-		BVH bvh{mesh};
+		//BVHs are built in place by concurrent tasks and can't be copied, the scene owns them
+		m_BoundingVolumeHierarchies.push_back(new BVH(mesh, settings));
+		return m_BoundingVolumeHierarchies.back();
+	}
 
-		m_BoundingVolumeHierarchies.emplace_back(bvh);
-		return &m_BoundingVolumeHierarchies.back();
+	Instance* Scene::AddInstance(BVH* pBVH, const Matrix& transform)
+	{
+		m_Instances.emplace_back(pBVH, transform);
+		return &m_Instances.back();
 	}
 
 	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
@@ -169,7 +189,7 @@ namespace dae {
 	unsigned char Scene::AddMaterial(Material* pMaterial)
 	{
 		m_Materials.push_back(pMaterial);
-		return static_cast<unsigned char>(m_Materials.size() - 1);
+		return m_MaterialTable.Add(*pMaterial);
 	}
 #pragma endregion
 #pragma endregion
@@ -400,15 +420,23 @@ namespace dae {
 
 	void Scene_W4_ReferenceScene::Update(Timer* pTimer)
 	{
-		Scene::Update(pTimer);
-
 		const auto yawAngle = (cos(pTimer->GetTotal()) + 1.f) / 2.f * PI_2;
 
+		ThreadPool& threadPool{ ThreadPool::Get() };
+		TaskGroup meshUpdates{};
+
 		for (const auto m : m_pMeshes)
 		{
-			m->RotateY(yawAngle);
-			m->UpdateTransforms();
+			threadPool.Submit(meshUpdates, [m, yawAngle]
+				{
+					m->RotateY(yawAngle);
+					m->UpdateTransforms();
+				});
 		}
+
+		//camera input is handled while the meshes update
+		Scene::Update(pTimer);
+		threadPool.Wait(meshUpdates);
 	}
 
 	//BUNNY SCENE
@@ -441,11 +469,14 @@ namespace dae {
 			std::cerr << "Error loading obj. Bunny Scene.\n";
 		m_pObjMesh->materialIndex = matLambert_White;
 		m_pObjMesh->cullMode = TriangleCullMode::BackFaceCulling;
-		m_pObjMesh->Scale({2,2,2});
-		m_pObjMesh->UpdateTransforms();
 
-		m_BVH = AddBVH(*m_pObjMesh);
-		m_pObjMesh->UpdateAABB();
+		//the bunny only rotates, so its BVH is built once in object space and moved through an instance
+		BVHBuildSettings bvhSettings{};
+		bvhSettings.objectSpace = true;
+		//the bunny never changes shape, so its tree is loaded from disk after the first run
+		bvhSettings.cacheDirectory = "BVHCache";
+		m_BVH = AddBVH(*m_pObjMesh, bvhSettings);
+		m_pBunny = AddInstance(m_BVH, Matrix::CreateScale(2, 2, 2));
 
 		//Light
 		AddPointLight(Vector3{ 0.0f, 5.0f, 5.0f }, 50.f, ColorRGB{ 1.0f, 0.61f, 0.45f }); // Backlight
@@ -458,10 +489,18 @@ namespace dae {
 		Scene::Update(pTimer);
 
 		const auto yawAngle = (cos(pTimer->GetTotal()) + 1.f) / 2.f * PI_2;
+		m_pBunny->SetTransform(Matrix::CreateScale(2, 2, 2) * Matrix::CreateRotationY(yawAngle));
+	}
 
-
-		m_pObjMesh->RotateY(yawAngle);
-		m_pObjMesh->UpdateTransforms();
-		m_BVH->Update();
+	Scene* CreateScene(const std::string& sceneName)
+	{
+		if (sceneName == "Scene_W1") return new Scene_W1();
+		if (sceneName == "Scene_W2") return new Scene_W2();
+		if (sceneName == "Scene_W3") return new Scene_W3();
+		if (sceneName == "Scene_W4") return new Scene_W4();
+		if (sceneName == "Scene_W4_ReferenceScene") return new Scene_W4_ReferenceScene();
+		if (sceneName == "Scene_W4_BunnyScene") return new Scene_W4_BunnyScene();
+
+		return nullptr;
 	}
 }
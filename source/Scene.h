@@ -1,4 +1,5 @@
 #pragma once
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -6,15 +7,20 @@
 #include "DataTypes.h"
 #include "Camera.h"
 #include "BVH.h"
+#include "TLAS.h"
+#include "Instance.h"
+#include "Material.h"
+#include "PrimitiveSets.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
+	struct RayPacket;
+	struct ShadowRayPacket;
 
 	//Scene Base Class
 	class Scene
@@ -36,30 +42,62 @@ namespace dae
 
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit);
+		//Occlusion test, ends at the first object hit within [ray.min, ray.max] without writing hit records
 		bool DoesHit(const Ray& ray);
+		//GetClosestHit for every ray in packet.rayMask at once, hitRecords holds one record per packet slot
+		void GetClosestHits(const RayPacket& packet, HitRecord* hitRecords);
+		//DoesHit for every shadow ray in the packet at once, returns the mask of the rays that hit something
+		uint32_t GetOccludedMask(const ShadowRayPacket& packet);
+
+		//Brings the sphere and plane sets and the top level BVH up to date with the current objects, call after they moved and before tracing
+		//The sphere BVH is only rebuilt after AddSphere and only refitted after MarkSpheresMoved, otherwise it is kept as is
+		//Triangle meshes above m_MeshBVHFaceThreshold get their BVH here on first sight and a refit after every UpdateTransforms
+		void UpdateTLAS();
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
 		const std::vector<Material*> GetMaterials() const { return m_Materials; }
-		const std::vector<BVH>& GetBoundingVolumeHierarchies() const { return m_BoundingVolumeHierarchies; };
+		//Flat copy of the materials above, what the renderer shades with
+		const MaterialTable& GetMaterialTable() const { return m_MaterialTable; }
+		const std::vector<BVH*>& GetBoundingVolumeHierarchies() const { return m_BoundingVolumeHierarchies; };
 
 	protected:
 		std::string	sceneName;
 
 		std::vector<Plane> m_PlaneGeometries{};
 		std::vector<Sphere> m_SphereGeometries{};
-		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
+		//a deque keeps the meshes in place as it grows, their BVHs and the scenes hold on to them
+		std::deque<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
 		std::vector<Material*> m_Materials{};
-		std::vector<BVH> m_BoundingVolumeHierarchies{};
+		MaterialTable m_MaterialTable{};
+		std::vector<BVH*> m_BoundingVolumeHierarchies{};
+		std::vector<Instance> m_Instances{};
+
+		//Meshes with more faces than this are traced through a BVH the scene builds and refits for them, smaller ones face by face
+		uint32_t m_MeshBVHFaceThreshold{ 16 };
+		//Settings of those BVHs, objectSpace and cacheDirectory are ignored since the meshes are placed by their own transforms
+		BVHBuildSettings m_MeshBVHSettings{};
+
+		//SIMD friendly copies of the spheres and planes above, the planes are rebuilt with the TLAS
+		SphereSet m_SphereSet{};
+		PlaneSet m_PlaneSet{};
+		bool m_RebuildSpheres{ false };
+		bool m_RefitSpheres{ false };
+
+		//spheres, triangle meshes, BVHs and instances are traced through the TLAS, planes are unbounded and tested directly
+		TLAS m_TLAS{};
 
 		Camera m_Camera{};
 
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
+		//Call after changing m_SphereGeometries in place, the next UpdateTLAS refits the sphere BVH to them
+		void MarkSpheresMoved() { m_RefitSpheres = true; }
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
-		BVH* AddBVH(TriangleMesh& mesh);
+		BVH* AddBVH(TriangleMesh& mesh, const BVHBuildSettings& settings = {});
+		Instance* AddInstance(BVH* pBVH, const Matrix& transform = {});
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
@@ -166,5 +204,9 @@ namespace dae
 	private:
 		TriangleMesh* m_pObjMesh{ nullptr };
 		BVH* m_BVH{ nullptr };
+		Instance* m_pBunny{ nullptr };
 	};
+
+	//Creates a scene by its class name (e.g. "Scene_W4_BunnyScene"), returns nullptr for unknown names
+	Scene* CreateScene(const std::string& sceneName);
 }
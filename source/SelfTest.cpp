@@ -0,0 +1,339 @@
+#include "SelfTest.h"
+#include "BVH.h"
+#include "Material.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace dae;
+
+namespace
+{
+	using ColorD = std::array<double, 3>;
+
+	//Fixed seed, every run checks the same points
+	constexpr uint32_t Seed{ 7 };
+	constexpr uint32_t NumBatches{ 512 };
+	constexpr uint32_t NumPowSamples{ 1 << 20 };
+
+	//Errors are relative, results smaller than this are compared absolutely so values near 0 don't dominate
+	constexpr double ErrorFloor{ 1e-3 };
+
+	double GetError(float value, double reference)
+	{
+		if (!std::isfinite(value)) return INFINITY;
+		return std::abs(value - reference) / std::max(std::abs(reference), ErrorFloor);
+	}
+
+	double Dot(const Vector3& v1, const Vector3& v2)
+	{
+		return double(v1.x) * v2.x + double(v1.y) * v2.y + double(v1.z) * v2.z;
+	}
+
+	Vector3 RandomDirection(std::mt19937& rng)
+	{
+		std::normal_distribution<float> distribution{};
+		return Vector3{ distribution(rng), distribution(rng), distribution(rng) }.Normalized();
+	}
+
+	//Light and view directions are flipped to the side of the normal, the renderer only shades lit points facing the camera
+	void FillBatch(ShadingBatch& batch, std::mt19937& rng)
+	{
+		batch.size = 0;
+		while (batch.size < ShadingBatch::MaxSize)
+		{
+			const Vector3 normal{ RandomDirection(rng) };
+			Vector3 l{ RandomDirection(rng) };
+			Vector3 v{ RandomDirection(rng) };
+			if (Vector3::Dot(normal, l) < 0) l = -l;
+			if (Vector3::Dot(normal, v) < 0) v = -v;
+
+			batch.Add(normal, l, v);
+		}
+	}
+
+	//Double precision evaluations of the scalar BRDFs, from the same float inputs
+	ColorD GetReference(const SolidColorMaterial& material, const Vector3&, const Vector3&, const Vector3&)
+	{
+		return { material.color.r, material.color.g, material.color.b };
+	}
+
+	ColorD GetLambert(double kd, const ColorRGB& cd)
+	{
+		const double scale{ kd / 3.14159265358979323846 };
+		return { cd.r * scale, cd.g * scale, cd.b * scale };
+	}
+
+	ColorD GetReference(const LambertMaterial& material, const Vector3&, const Vector3&, const Vector3&)
+	{
+		return GetLambert(material.diffuseReflectance, material.diffuseColor);
+	}
+
+	ColorD GetReference(const LambertPhongMaterial& material, const Vector3& n, const Vector3& l, const Vector3& v)
+	{
+		const double nl{ Dot(n, l) };
+		const double cosAngle{ std::max(-(l.x - 2 * nl * n.x) * v.x - (l.y - 2 * nl * n.y) * v.y - (l.z - 2 * nl * n.z) * v.z, 0.0) };
+		const double specular{ material.specularReflectance * std::pow(cosAngle, double(material.phongExponent)) };
+
+		const ColorD diffuse{ GetLambert(material.diffuseReflectance, material.diffuseColor) };
+		return { diffuse[0] + specular, diffuse[1] + specular, diffuse[2] + specular };
+	}
+
+	ColorD GetReference(const CookTorrenceMaterial& material, const Vector3& n, const Vector3& l, const Vector3& v)
+	{
+		const double halfX{ double(v.x) + l.x }, halfY{ double(v.y) + l.y }, halfZ{ double(v.z) + l.z };
+		const double halfLength{ std::sqrt(halfX * halfX + halfY * halfY + halfZ * halfZ) };
+		const double nh{ (n.x * halfX + n.y * halfY + n.z * halfZ) / halfLength };
+		const double hv{ std::max((v.x * halfX + v.y * halfY + v.z * halfZ) / halfLength, 0.0) };
+		const double nv{ Dot(n, v) };
+		const double nl{ Dot(n, l) };
+
+		//The material squares its roughness and the BRDF functions square it again
+		const double alpha{ double(material.roughness) * material.roughness };
+		const double alpha2{ alpha * alpha };
+		const double distributionDenominator{ nh * nh * (alpha2 - 1) + 1 };
+		const double distribution{ alpha2 / (3.14159265358979323846 * distributionDenominator * distributionDenominator) };
+
+		const double k{ (alpha + 1) * (alpha + 1) / 8 };
+		const auto schlickGGX = [k](double angle) { angle = std::max(angle, 0.0); return angle / (angle * (1 - k) + k); };
+		const double geometry{ schlickGGX(nv) * schlickGGX(nl) };
+
+		const std::array<float, 3> albedo{ material.albedo.r, material.albedo.g, material.albedo.b };
+		ColorD color{};
+		for (size_t c{ 0 }; c < color.size(); ++c)
+		{
+			const double f0{ material.metalness == 0 ? 0.04 : albedo[c] };
+			const double fresnel{ f0 + (1 - f0) * std::pow(1 - hv, 5) };
+			const double kd{ material.metalness == 0 ? 1 - fresnel : 0.0 };
+			color[c] = kd * albedo[c] / 3.14159265358979323846 + distribution * fresnel * geometry / (4 * nv * nl);
+		}
+		return color;
+	}
+
+	//BRDFs.h: relative error bounds of the batch path per material type
+	double GetErrorBound(const SolidColorMaterial&) { return 1e-6; }
+	double GetErrorBound(const LambertMaterial&) { return 1e-6; }
+	double GetErrorBound(const LambertPhongMaterial& material) { return 2e-6 * (1 + material.phongExponent); }
+	double GetErrorBound(const CookTorrenceMaterial& material)
+	{
+		const double roughness2{ double(material.roughness) * material.roughness };
+		return 1e-5 + 5e-7 / (roughness2 * roughness2);
+	}
+
+	//Shades random batches through the batch path, measured against the double precision reference
+	template<typename MaterialType>
+	double MeasureShading(const MaterialType& material, bool useLookupTables, std::mt19937& rng)
+	{
+		static ShadingBatch batch{};
+		static ShadingResults results{};
+
+		double maxError{};
+		for (uint32_t batchIdx{ 0 }; batchIdx < NumBatches; ++batchIdx)
+		{
+			FillBatch(batch, rng);
+			batch.useLookupTables = useLookupTables;
+			material.Shade(batch, results);
+
+			for (uint32_t i{ 0 }; i < batch.size; ++i)
+			{
+				const Vector3 n{ batch.normalX[i], batch.normalY[i], batch.normalZ[i] };
+				const Vector3 l{ batch.lightX[i], batch.lightY[i], batch.lightZ[i] };
+				const Vector3 v{ batch.viewX[i], batch.viewY[i], batch.viewZ[i] };
+
+				const ColorD reference{ GetReference(material, n, l, v) };
+				const ColorRGB color{ results.Get(i) };
+
+				const std::array<float, 3> channels{ color.r, color.g, color.b };
+				for (size_t c{ 0 }; c < reference.size(); ++c) maxError = std::max(maxError, GetError(channels[c], reference[c]));
+			}
+		}
+		return maxError;
+	}
+
+	bool Report(const char* name, double error, double bound)
+	{
+		const bool passed{ error <= bound };
+		std::cout << std::left << std::setw(32) << name << std::right << std::scientific << std::setprecision(2)
+			<< " error " << error << "  bound " << bound << (passed ? "" : "  FAILED") << std::endl;
+		return passed;
+	}
+
+	template<typename MaterialType>
+	bool CheckShading(const char* name, const MaterialType& material, std::mt19937& rng)
+	{
+		return Report(name, MeasureShading(material, false, rng), GetErrorBound(material));
+	}
+
+	CookTorrenceMaterial MakeCookTorrence(const ColorRGB& albedo, float metalness, float roughness)
+	{
+		CookTorrenceMaterial material{ albedo, metalness, roughness };
+		material.Precompute();
+		return material;
+	}
+
+	//CookTorrenceTables.h: the table path stays within 1% down to roughness 0.1
+	bool CheckLookupTables(const char* name, const CookTorrenceMaterial& exactMaterial, std::mt19937& rng)
+	{
+		constexpr double ErrorBound{ 1e-2 };
+
+		const GeometryTable geometryTable{ exactMaterial.roughness };
+		CookTorrenceMaterial material{ exactMaterial };
+		material.pGeometryTable = &geometryTable;
+		return Report(name, MeasureShading(material, true, rng), ErrorBound);
+	}
+
+	//SIMD.h bounds the relative error of Pow by a multiple of the exponent for integer exponents up to 64,
+	//and of 1 + |exponent * log2(x)| for the others, the checks report the largest error per unit of that
+	//Results below FLT_MIN are skipped, denormals are outside what Pow promises
+	bool CheckPow(std::mt19937& rng)
+	{
+		constexpr double IntegerErrorPerUnit{ 1e-7 };
+		constexpr double ErrorPerUnit{ 3e-7 };
+
+		std::uniform_real_distribution<float> baseDistribution{ 0.f, 1.f };
+		std::uniform_real_distribution<float> exponentDistribution{ 0.f, 200.f };
+
+		alignas(32) float bases[SIMD::NativeWidth];
+		alignas(32) float powers[SIMD::NativeWidth];
+
+		double maxIntegerError{};
+		double maxError{};
+		for (uint32_t sample{ 0 }; sample < NumPowSamples; sample += SIMD::NativeWidth)
+		{
+			//Every other exponent is whole, up to 64 those take the multiplication path
+			float exponent{ exponentDistribution(rng) };
+			if (sample / SIMD::NativeWidth % 2) exponent = std::floor(exponent);
+			const bool isInteger{ exponent <= 64.f && exponent == std::floor(exponent) };
+
+			for (uint32_t lane{ 0 }; lane < SIMD::NativeWidth; ++lane) bases[lane] = baseDistribution(rng);
+			SIMD::Store(powers, SIMD::Pow(SIMD::Load(bases), exponent));
+
+			for (uint32_t lane{ 0 }; lane < SIMD::NativeWidth; ++lane)
+			{
+				const double reference{ std::pow(double(bases[lane]), double(exponent)) };
+				if (reference < FLT_MIN) continue;
+
+				const double error{ std::isfinite(powers[lane]) ? std::abs(powers[lane] - reference) / reference : INFINITY };
+				if (isInteger)
+					maxIntegerError = std::max(maxIntegerError, error / std::max(double(exponent), 1.0));
+				else
+					maxError = std::max(maxError, error / (1 + std::abs(exponent * std::log2(double(bases[lane])))));
+			}
+		}
+
+		const bool integerPassed{ Report("SIMD::Pow integer, per unit", maxIntegerError, IntegerErrorPerUnit) };
+		return Report("SIMD::Pow, per unit", maxError, ErrorPerUnit) && integerPassed;
+	}
+
+	//Torus of rings * sides quads, no degenerate faces and enough of them for a BVH several levels deep
+	TriangleMesh MakeTorus(uint32_t rings, uint32_t sides)
+	{
+		std::vector<Vector3> positions{};
+		for (uint32_t ring{ 0 }; ring < rings; ++ring)
+		{
+			const float ringAngle{ PI_2 * ring / rings };
+			for (uint32_t side{ 0 }; side < sides; ++side)
+			{
+				const float sideAngle{ PI_2 * side / sides };
+				const float radius{ 1.f + 0.4f * std::cos(sideAngle) };
+				positions.emplace_back(radius * std::cos(ringAngle), 0.4f * std::sin(sideAngle), radius * std::sin(ringAngle));
+			}
+		}
+
+		std::vector<int> indices{};
+		for (uint32_t ring{ 0 }; ring < rings; ++ring)
+		{
+			for (uint32_t side{ 0 }; side < sides; ++side)
+			{
+				const int v0{ static_cast<int>(ring * sides + side) };
+				const int v1{ static_cast<int>(ring * sides + (side + 1) % sides) };
+				const int v2{ static_cast<int>((ring + 1) % rings * sides + side) };
+				const int v3{ static_cast<int>((ring + 1) % rings * sides + (side + 1) % sides) };
+				indices.insert(indices.end(), { v0, v1, v2, v2, v1, v3 });
+			}
+		}
+		return TriangleMesh{ positions, indices, TriangleCullMode::NoCulling };
+	}
+
+	//Refits a scaled mesh to a new rotation and translation and traces it next to a tree freshly built for the same vertices
+	//Both hold the same triangles, so t and the normal of every hit have to match, a miss on one side only counts as infinite error
+	bool CheckRefit(std::mt19937& rng)
+	{
+		constexpr uint32_t NumRays{ 1 << 16 };
+		constexpr double ErrorBound{ 1e-6 };
+
+		BVHBuildSettings settings{};
+		settings.rebuildCostRatio = 0.f;
+
+		TriangleMesh mesh{ MakeTorus(64, 32) };
+		mesh.Scale({ 2.f, 2.f, 2.f });
+		mesh.UpdateTransforms();
+		BVH refitted{ mesh, settings };
+
+		const Vector3 center{ 1.f, 2.f, 3.f };
+		mesh.RotateY(0.7f);
+		mesh.Translate(center);
+		mesh.UpdateTransforms();
+		refitted.Update();
+		BVH built{ mesh, settings };
+
+		std::uniform_real_distribution<float> targetDistribution{ -3.f, 3.f };
+		double maxError{};
+		for (uint32_t rayIdx{ 0 }; rayIdx < NumRays; ++rayIdx)
+		{
+			const Vector3 origin{ center + RandomDirection(rng) * 10.f };
+			const Vector3 target{ center + Vector3{ targetDistribution(rng), targetDistribution(rng) * 0.5f, targetDistribution(rng) } };
+			const Vector3 direction{ (target - origin).Normalized() };
+			const Ray ray{ origin, direction, { 1 / direction.x, 1 / direction.y, 1 / direction.z } };
+
+			HitRecord refittedHit{}, builtHit{};
+			refitted.IntersectBVH(ray, refittedHit);
+			built.IntersectBVH(ray, builtHit);
+
+			if (refittedHit.didHit != builtHit.didHit) maxError = INFINITY;
+			if (!builtHit.didHit) continue;
+
+			maxError = std::max(maxError, GetError(refittedHit.t, builtHit.t));
+			for (int axis{ 0 }; axis < 3; ++axis) maxError = std::max(maxError, GetError(refittedHit.normal[axis], builtHit.normal[axis]));
+		}
+		return Report("BVH refit against fresh build", maxError, ErrorBound);
+	}
+}
+
+bool dae::SelfTest::Run()
+{
+	std::mt19937 rng{ Seed };
+	std::cout << "Self test, " << SIMD::NativeWidth << " lanes" << std::endl;
+
+	bool passed{ true };
+	passed &= CheckPow(rng);
+
+	passed &= CheckShading("Solid color", SolidColorMaterial{ { 0.3f, 0.6f, 0.9f } }, rng);
+	passed &= CheckShading("Lambert", LambertMaterial{ { 0.3f, 0.6f, 0.9f }, 0.8f }, rng);
+	passed &= CheckShading("Lambert-Phong exp 3", LambertPhongMaterial{ colors::Blue, 0.5f, 0.5f, 3.f }, rng);
+	passed &= CheckShading("Lambert-Phong exp 15.5", LambertPhongMaterial{ colors::Blue, 0.5f, 0.5f, 15.5f }, rng);
+	passed &= CheckShading("Lambert-Phong exp 60", LambertPhongMaterial{ colors::Blue, 0.5f, 0.5f, 60.f }, rng);
+	passed &= CheckShading("Lambert-Phong exp 99.3", LambertPhongMaterial{ colors::Blue, 0.5f, 0.5f, 99.3f }, rng);
+	passed &= CheckShading("Cook-Torrence metal rough 1", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f), rng);
+	passed &= CheckShading("Cook-Torrence metal rough 0.6", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f), rng);
+	passed &= CheckShading("Cook-Torrence metal rough 0.1", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f), rng);
+	passed &= CheckShading("Cook-Torrence plastic rough 1", MakeCookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f), rng);
+	passed &= CheckShading("Cook-Torrence plastic rough 0.6", MakeCookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f), rng);
+	passed &= CheckShading("Cook-Torrence plastic rough 0.1", MakeCookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f), rng);
+
+	passed &= CheckLookupTables("Tables metal rough 1", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f), rng);
+	passed &= CheckLookupTables("Tables metal rough 0.6", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f), rng);
+	passed &= CheckLookupTables("Tables metal rough 0.3", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.3f), rng);
+	passed &= CheckLookupTables("Tables metal rough 0.1", MakeCookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f), rng);
+	passed &= CheckLookupTables("Tables plastic rough 0.6", MakeCookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f), rng);
+	passed &= CheckLookupTables("Tables plastic rough 0.1", MakeCookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f), rng);
+
+	passed &= CheckRefit(rng);
+
+	std::cout << (passed ? "Self test passed" : "Self test FAILED") << std::endl;
+	return passed;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace dae
+{
+	//Accuracy checks of the SIMD shading paths against double precision references and of BVH refits against fresh builds, run with --selftest
+	namespace SelfTest
+	{
+		//Prints the largest error of every check next to its bound, returns false when any bound is exceeded
+		bool Run();
+	}
+}
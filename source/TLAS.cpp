@@ -0,0 +1,447 @@
+#include "TLAS.h"
+#include "BVH.h"
+#include "Instance.h"
+#include "PrimitiveSets.h"
+#include "RayPacket.h"
+#include "Utils.h"
+#include <algorithm>
+#include <bit>
+
+namespace
+{
+	struct Bin
+	{
+		dae::AABB bounds{};
+		uint32_t objectCount{ 0 };
+	};
+
+	//Entry distance of the ray into the box, FLT_MAX on a miss
+	float IntersectBounds(const dae::AABB& bounds, const dae::Ray& ray)
+	{
+		const float tx1{ (bounds.minAABB.x - ray.origin.x) * ray.reciproke.x }, tx2{ (bounds.maxAABB.x - ray.origin.x) * ray.reciproke.x };
+		float tmin{ std::min(tx1, tx2) }, tmax{ std::max(tx1, tx2) };
+		const float ty1{ (bounds.minAABB.y - ray.origin.y) * ray.reciproke.y }, ty2{ (bounds.maxAABB.y - ray.origin.y) * ray.reciproke.y };
+		tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+		const float tz1{ (bounds.minAABB.z - ray.origin.z) * ray.reciproke.z }, tz2{ (bounds.maxAABB.z - ray.origin.z) * ray.reciproke.z };
+		tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+
+		//ray.max holds a squared distance, like in the primitive tests
+		if (tmax < tmin || tmax <= 0 || (tmin > 0 && tmin * tmin > ray.max)) return FLT_MAX;
+		return tmin;
+	}
+}
+
+void dae::TLAS::Build(const SphereSet& spheres, const std::deque<TriangleMesh>& triangleMeshes, const std::vector<BVH*>& bvhs, const std::vector<Instance>& instances)
+{
+	m_pSpheres = &spheres;
+	m_pTriangleMeshes = &triangleMeshes;
+	m_pBVHs = &bvhs;
+	m_pInstances = &instances;
+
+	m_Objects.clear();
+	m_Objects.reserve(1 + triangleMeshes.size() + bvhs.size() + instances.size());
+
+	const auto addObject = [this](const AABB& bounds, TLASObjectType type, uint32_t index)
+	{
+		m_Objects.push_back({ bounds, (bounds.minAABB + bounds.maxAABB) * .5f, type, index });
+	};
+
+	if (!spheres.IsEmpty()) addObject(spheres.GetBounds(), TLASObjectType::Spheres, 0);
+
+	for (uint32_t i = 0; i < triangleMeshes.size(); ++i)
+	{
+		//meshes with a BVH enter through it below
+		if (triangleMeshes[i].pBVH) continue;
+		addObject({ triangleMeshes[i].transformedMinAABB, triangleMeshes[i].transformedMaxAABB }, TLASObjectType::TriangleMesh, i);
+	}
+
+	for (uint32_t i = 0; i < bvhs.size(); ++i)
+	{
+		if (bvhs[i]->IsObjectSpace()) continue;
+		addObject(bvhs[i]->GetBounds(), TLASObjectType::BVH, i);
+	}
+
+	for (uint32_t i = 0; i < instances.size(); ++i)
+	{
+		addObject(instances[i].GetBounds(), TLASObjectType::Instance, i);
+	}
+
+	m_NodesUsed = 0;
+	if (m_Objects.empty()) return;
+
+	//a binary tree over n leaves never needs more than 2n - 1 nodes
+	m_Nodes.resize(m_Objects.size() * 2 - 1);
+
+	BVHNode& root = m_Nodes[m_NodesUsed++];
+	root.leftFirst = 0;
+	root.triCount = static_cast<uint32_t>(m_Objects.size());
+
+	UpdateNodeBounds(0);
+	Subdivide(0);
+}
+
+void dae::TLAS::UpdateNodeBounds(uint32_t nodeIdx)
+{
+	BVHNode& node = m_Nodes[nodeIdx];
+	node.bounds = {};
+
+	for (uint32_t i = 0; i < node.triCount; ++i)
+	{
+		node.bounds.Grow(m_Objects[node.leftFirst + i].bounds);
+	}
+}
+
+void dae::TLAS::Subdivide(uint32_t nodeIdx)
+{
+	BVHNode& node = m_Nodes[nodeIdx];
+	if (node.triCount <= MaxLeafSize) return;
+
+	AABB centroidBounds{};
+	for (uint32_t i = 0; i < node.triCount; ++i)
+	{
+		centroidBounds.Grow(m_Objects[node.leftFirst + i].centroid);
+	}
+
+	//binned SAH over the object centroids, same as the mesh BVH builder
+	int axis{ -1 };
+	float splitPos{ 0 };
+	float bestCost{ FLT_MAX };
+	for (int a = 0; a < 3; ++a)
+	{
+		const float extent{ centroidBounds.maxAABB[a] - centroidBounds.minAABB[a] };
+		if (extent <= 0) continue;
+		const float scale{ BinCount / extent };
+
+		Bin bins[BinCount]{};
+		for (uint32_t i = 0; i < node.triCount; ++i)
+		{
+			const TLASObject& object = m_Objects[node.leftFirst + i];
+			const uint32_t binIdx{ std::min(BinCount - 1, static_cast<uint32_t>((object.centroid[a] - centroidBounds.minAABB[a]) * scale)) };
+			++bins[binIdx].objectCount;
+			bins[binIdx].bounds.Grow(object.bounds);
+		}
+
+		float leftArea[BinCount - 1]{}, rightArea[BinCount - 1]{};
+		uint32_t leftCount[BinCount - 1]{}, rightCount[BinCount - 1]{};
+		AABB leftBox{}, rightBox{};
+		uint32_t leftSum{ 0 }, rightSum{ 0 };
+		for (uint32_t i = 0; i < BinCount - 1; ++i)
+		{
+			leftSum += bins[i].objectCount;
+			leftCount[i] = leftSum;
+			leftBox.Grow(bins[i].bounds);
+			leftArea[i] = leftBox.area();
+
+			rightSum += bins[BinCount - 1 - i].objectCount;
+			rightCount[BinCount - 2 - i] = rightSum;
+			rightBox.Grow(bins[BinCount - 1 - i].bounds);
+			rightArea[BinCount - 2 - i] = rightBox.area();
+		}
+
+		for (uint32_t i = 0; i < BinCount - 1; ++i)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+			const float cost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
+			if (cost < bestCost)
+			{
+				axis = a;
+				splitPos = centroidBounds.minAABB[a] + extent / BinCount * (i + 1);
+				bestCost = cost;
+			}
+		}
+	}
+
+	//split only when the traversal step and the children are cheaper than testing every object of this node
+	if (axis == -1 || BVHTraversalCost * node.bounds.area() + bestCost >= node.triCount * node.bounds.area()) return;
+
+	const auto first = m_Objects.begin() + node.leftFirst;
+	const auto middle = std::partition(first, first + node.triCount,
+		[axis, splitPos](const TLASObject& object) { return object.centroid[axis] < splitPos; });
+
+	const uint32_t leftCount{ static_cast<uint32_t>(middle - first) };
+	if (leftCount == 0 || leftCount == node.triCount) return;
+
+	const uint32_t leftChildIdx{ m_NodesUsed };
+	m_NodesUsed += 2;
+	m_Nodes[leftChildIdx].leftFirst = node.leftFirst;
+	m_Nodes[leftChildIdx].triCount = leftCount;
+	m_Nodes[leftChildIdx + 1].leftFirst = node.leftFirst + leftCount;
+	m_Nodes[leftChildIdx + 1].triCount = node.triCount - leftCount;
+	node.leftFirst = leftChildIdx;
+	node.triCount = 0;
+
+	UpdateNodeBounds(leftChildIdx);
+	UpdateNodeBounds(leftChildIdx + 1);
+	Subdivide(leftChildIdx);
+	Subdivide(leftChildIdx + 1);
+}
+
+void dae::TLAS::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+{
+	if (m_NodesUsed == 0) return;
+
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		float dist;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+
+	const float rootDist{ IntersectBounds(m_Nodes[0].bounds, ray) };
+	if (rootDist == FLT_MAX) return;
+	stack[stackPtr++] = { 0, rootDist };
+
+	while (stackPtr > 0)
+	{
+		const StackEntry entry{ stack[--stackPtr] };
+
+		//a closer hit was found since this node was pushed
+		if (entry.dist >= closestHit.t) continue;
+
+		const BVHNode& node = m_Nodes[entry.nodeIdx];
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i < node.triCount; ++i)
+			{
+				HitObject(m_Objects[node.leftFirst + i], ray, closestHit);
+			}
+			continue;
+		}
+
+		uint32_t child1{ node.leftFirst }, child2{ node.leftFirst + 1 };
+		float dist1{ IntersectBounds(m_Nodes[child1].bounds, ray) };
+		float dist2{ IntersectBounds(m_Nodes[child2].bounds, ray) };
+
+		if (dist1 > dist2)
+		{
+			std::swap(dist1, dist2);
+			std::swap(child1, child2);
+		}
+
+		//far child first, so the near one is popped next
+		if (dist2 < closestHit.t) stack[stackPtr++] = { child2, dist2 };
+		if (dist1 < closestHit.t) stack[stackPtr++] = { child1, dist1 };
+	}
+}
+
+bool dae::TLAS::DoesHit(const Ray& ray) const
+{
+	if (m_NodesUsed == 0) return false;
+
+	uint32_t stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = 0;
+
+	while (stackPtr > 0)
+	{
+		const BVHNode& node = m_Nodes[stack[--stackPtr]];
+		if (IntersectBounds(node.bounds, ray) == FLT_MAX) continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i < node.triCount; ++i)
+			{
+				if (DoesHitObject(m_Objects[node.leftFirst + i], ray)) return true;
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = node.leftFirst + 1;
+		stack[stackPtr++] = node.leftFirst;
+	}
+
+	return false;
+}
+
+void dae::TLAS::GetClosestHits(const RayPacket& packet, HitRecord* hitRecords) const
+{
+	if (m_NodesUsed == 0) return;
+
+	alignas(32) float closestT[RayPacket::Size];
+	for (uint32_t i = 0; i < RayPacket::Size; ++i)
+	{
+		closestT[i] = hitRecords[i].t;
+	}
+
+	//one stack for the whole packet, every entry remembers which rays reached the node
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+
+	float entry;
+	const uint32_t rootMask{ packet.IntersectBounds(m_Nodes[0].bounds, packet.rayMask, closestT, entry) };
+	if (rootMask) stack[stackPtr++] = { 0, rootMask };
+
+	while (stackPtr > 0)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_Nodes[current.nodeIdx];
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i < node.triCount; ++i)
+			{
+				HitObjectPacket(m_Objects[node.leftFirst + i], packet, current.rayMask, hitRecords);
+			}
+
+			for (uint32_t mask = current.rayMask; mask; mask &= mask - 1)
+			{
+				const uint32_t i{ static_cast<uint32_t>(std::countr_zero(mask)) };
+				closestT[i] = hitRecords[i].t;
+			}
+			continue;
+		}
+
+		uint32_t child1{ node.leftFirst }, child2{ node.leftFirst + 1 };
+		float entry1, entry2;
+		uint32_t mask1{ packet.IntersectBounds(m_Nodes[child1].bounds, current.rayMask, closestT, entry1) };
+		uint32_t mask2{ packet.IntersectBounds(m_Nodes[child2].bounds, current.rayMask, closestT, entry2) };
+
+		if (entry1 > entry2)
+		{
+			std::swap(entry1, entry2);
+			std::swap(child1, child2);
+			std::swap(mask1, mask2);
+		}
+
+		//far child first, so the near one is popped next
+		if (mask2) stack[stackPtr++] = { child2, mask2 };
+		if (mask1) stack[stackPtr++] = { child1, mask1 };
+	}
+}
+
+uint32_t dae::TLAS::GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const
+{
+	if (m_NodesUsed == 0) return 0;
+
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rayMask;
+	};
+	StackEntry stack[64];
+	uint32_t stackPtr{ 0 };
+	stack[stackPtr++] = { 0, rayMask };
+
+	uint32_t occludedMask{ 0 };
+	float entry;
+
+	//occluded rays drop out of every entry still on the stack, the traversal ends once none are left
+	while (stackPtr > 0 && occludedMask != rayMask)
+	{
+		const StackEntry current{ stack[--stackPtr] };
+		const BVHNode& node = m_Nodes[current.nodeIdx];
+
+		const uint32_t nodeMask{ packet.reversed.IntersectBounds(node.bounds, current.rayMask & ~occludedMask, packet.length, entry) };
+		if (nodeMask == 0) continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = 0; i < node.triCount; ++i)
+			{
+				occludedMask |= GetObjectOccludedMask(m_Objects[node.leftFirst + i], packet, nodeMask & ~occludedMask);
+			}
+			continue;
+		}
+
+		//any hit will do, so the children aren't sorted
+		stack[stackPtr++] = { node.leftFirst + 1, nodeMask };
+		stack[stackPtr++] = { node.leftFirst, nodeMask };
+	}
+
+	return occludedMask;
+}
+
+void dae::TLAS::HitObject(const TLASObject& object, const Ray& ray, HitRecord& closestHit) const
+{
+	switch (object.type)
+	{
+	case TLASObjectType::Spheres:
+		m_pSpheres->HitTest(ray, closestHit);
+		break;
+	case TLASObjectType::TriangleMesh:
+		//only replaces closestHit with closer hits
+		GeometryUtils::HitTest_TriangleMesh((*m_pTriangleMeshes)[object.index], ray, closestHit);
+		break;
+	case TLASObjectType::BVH:
+		GeometryUtils::HitTest_BVH(*(*m_pBVHs)[object.index], ray, closestHit);
+		break;
+	case TLASObjectType::Instance:
+		(*m_pInstances)[object.index].Intersect(ray, closestHit);
+		break;
+	}
+}
+
+void dae::TLAS::HitObjectPacket(const TLASObject& object, const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const
+{
+	switch (object.type)
+	{
+	case TLASObjectType::BVH:
+		(*m_pBVHs)[object.index]->IntersectPacket(packet, rayMask, hitRecords);
+		break;
+	case TLASObjectType::Instance:
+		(*m_pInstances)[object.index].IntersectPacket(packet, rayMask, hitRecords);
+		break;
+	case TLASObjectType::Spheres:
+		m_pSpheres->IntersectPacket(packet, rayMask, hitRecords);
+		break;
+	case TLASObjectType::TriangleMesh:
+	default:
+		//plain meshes have no packet test, the rays go one by one
+		for (; rayMask; rayMask &= rayMask - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(rayMask)) };
+			HitObject(object, packet.GetRay(i), hitRecords[i]);
+		}
+		break;
+	}
+}
+
+bool dae::TLAS::DoesHitObject(const TLASObject& object, const Ray& ray) const
+{
+	switch (object.type)
+	{
+	case TLASObjectType::Spheres:
+		return m_pSpheres->DoesHit(ray);
+	case TLASObjectType::TriangleMesh:
+		return GeometryUtils::DoesHit_TriangleMesh((*m_pTriangleMeshes)[object.index], ray);
+	case TLASObjectType::BVH:
+		return GeometryUtils::DoesHit_BVH(*(*m_pBVHs)[object.index], ray);
+	case TLASObjectType::Instance:
+		return (*m_pInstances)[object.index].DoesHit(ray);
+	}
+
+	return false;
+}
+
+uint32_t dae::TLAS::GetObjectOccludedMask(const TLASObject& object, const ShadowRayPacket& packet, uint32_t rayMask) const
+{
+	switch (object.type)
+	{
+	case TLASObjectType::BVH:
+		return (*m_pBVHs)[object.index]->GetOccludedMask(packet, rayMask);
+	case TLASObjectType::Instance:
+		return (*m_pInstances)[object.index].GetOccludedMask(packet, rayMask);
+	case TLASObjectType::Spheres:
+		return m_pSpheres->GetOccludedMask(packet, rayMask);
+	case TLASObjectType::TriangleMesh:
+	default:
+	{
+		//plain meshes gain nothing from the packet, their rays go one by one
+		uint32_t occludedMask{ 0 };
+		for (; rayMask; rayMask &= rayMask - 1)
+		{
+			const uint32_t i{ static_cast<uint32_t>(std::countr_zero(rayMask)) };
+			if (DoesHitObject(object, packet.rays[i])) occludedMask |= 1u << i;
+		}
+		return occludedMask;
+	}
+	}
+}
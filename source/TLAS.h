@@ -0,0 +1,83 @@
+#pragma once
+
+#include "DataTypes.h"
+#include <deque>
+#include <vector>
+
+namespace dae
+{
+	class BVH;
+	class Instance;
+	class SphereSet;
+	struct RayPacket;
+	struct ShadowRayPacket;
+
+	enum class TLASObjectType : uint8_t
+	{
+		Spheres,
+		TriangleMesh,
+		BVH,
+		Instance
+	};
+
+	//Reference to one object in the scene's lists, together with its world space bounds
+	struct TLASObject
+	{
+		AABB bounds{};
+		Vector3 centroid{};
+		TLASObjectType type{};
+		uint32_t index{};
+	};
+
+	//Top level BVH over the bounds of every bounded scene object, infinite planes stay outside of it
+	//Rebuilt from scratch every frame, so moving objects never degrade it
+	class TLAS final
+	{
+	public:
+		TLAS() = default;
+		~TLAS() = default;
+
+		TLAS(const TLAS&) = delete;
+		TLAS(TLAS&&) noexcept = delete;
+		TLAS& operator=(const TLAS&) = delete;
+		TLAS& operator=(TLAS&&) noexcept = delete;
+
+		//The lists are referenced until the next Build, they have to outlive the traversals
+		//Object space BVHs are skipped, they are only traced through the instances placing them
+		//Meshes with a pBVH are skipped as well, their BVH in bvhs stands in for them
+		//All spheres enter as a single object, the SphereSet's own BVH takes over below it
+		void Build(const SphereSet& spheres, const std::deque<TriangleMesh>& triangleMeshes, const std::vector<BVH*>& bvhs, const std::vector<Instance>& instances);
+
+		//Only updates closestHit when an object is hit closer than closestHit.t, subtrees behind it are skipped
+		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHit(const Ray& ray) const;
+
+		//GetClosestHit for every ray in packet.rayMask at once, hitRecords holds one record per packet slot
+		void GetClosestHits(const RayPacket& packet, HitRecord* hitRecords) const;
+		//DoesHit for the rays in rayMask at once, returns the mask of the rays that hit something
+		uint32_t GetOccludedMask(const ShadowRayPacket& packet, uint32_t rayMask) const;
+
+		uint32_t GetObjectCount() const { return static_cast<uint32_t>(m_Objects.size()); }
+
+	private:
+		void Subdivide(uint32_t nodeIdx);
+		void UpdateNodeBounds(uint32_t nodeIdx);
+
+		void HitObject(const TLASObject& object, const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHitObject(const TLASObject& object, const Ray& ray) const;
+		void HitObjectPacket(const TLASObject& object, const RayPacket& packet, uint32_t rayMask, HitRecord* hitRecords) const;
+		uint32_t GetObjectOccludedMask(const TLASObject& object, const ShadowRayPacket& packet, uint32_t rayMask) const;
+
+		static constexpr uint32_t BinCount{ 8 };
+		static constexpr uint32_t MaxLeafSize{ 2 };
+
+		std::vector<TLASObject> m_Objects{};
+		std::vector<BVHNode> m_Nodes{}; //leftFirst/triCount index into m_Objects for leaves
+		uint32_t m_NodesUsed{ 0 };
+
+		const SphereSet* m_pSpheres{};
+		const std::deque<TriangleMesh>* m_pTriangleMeshes{};
+		const std::vector<BVH*>* m_pBVHs{};
+		const std::vector<Instance>* m_pInstances{};
+	};
+}
@@ -0,0 +1,211 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace dae;
+
+namespace
+{
+	//index of the queue owned by the current thread, 0 for threads outside the pool
+	thread_local uint32_t t_QueueIdx{ 0 };
+	thread_local const ThreadPool* t_pOwnerPool{ nullptr };
+}
+
+ThreadPool::ThreadPool(uint32_t numThreads) :
+	m_Queues(std::max(numThreads, 1u))
+{
+	//the waiting thread helps out, so spawn one less
+	const uint32_t numWorkers{ numThreads > 1 ? numThreads - 1 : 0 };
+
+	m_Workers.reserve(numWorkers);
+	for (uint32_t i{ 0 }; i < numWorkers; ++i)
+	{
+		m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{ m_SleepMutex };
+		m_Quit = true;
+	}
+	m_SleepCondition.notify_all();
+
+	for (auto& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool{};
+	return pool;
+}
+
+void ThreadPool::Submit(TaskGroup& group, std::function<void()> task)
+{
+	group.m_PendingTasks.fetch_add(1, std::memory_order_relaxed);
+
+	//counted before the task is visible, the thread running it decrements the count
+	{
+		std::lock_guard lock{ m_SleepMutex };
+		m_QueuedTasks.fetch_add(1, std::memory_order_release);
+	}
+
+	WorkQueue& queue = m_Queues[GetQueueIndex()];
+	{
+		std::lock_guard lock{ queue.mutex };
+		queue.tasks.push_back({ std::move(task), &group });
+	}
+	m_SleepCondition.notify_one();
+	m_WaitCondition.notify_one(); //a sleeping waiter helps out too
+}
+
+void ThreadPool::Wait(TaskGroup& group)
+{
+	const uint32_t queueIdx{ GetQueueIndex() };
+
+	while (!group.IsDone())
+	{
+		if (TryRunTask(queueIdx)) continue;
+
+		//nothing left to help with, the group's last tasks are running on other threads
+		std::unique_lock lock{ m_SleepMutex };
+		m_WaitCondition.wait(lock, [this, &group] { return group.IsDone() || m_QueuedTasks.load(std::memory_order_acquire) > 0; });
+	}
+
+	if (group.m_Exception)
+	{
+		const std::exception_ptr exception{ std::exchange(group.m_Exception, nullptr) };
+		std::rethrow_exception(exception);
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func)
+{
+	if (begin >= end) return;
+	grainSize = std::max(grainSize, 1u);
+
+	std::atomic<uint32_t> nextIdx{ begin };
+	const auto processChunks = [&]()
+	{
+		for (uint32_t chunkBegin{ nextIdx.fetch_add(grainSize) }; chunkBegin < end; chunkBegin = nextIdx.fetch_add(grainSize))
+		{
+			func(chunkBegin, std::min(chunkBegin + grainSize, end));
+		}
+	};
+
+	//no point in waking more threads than there are chunks
+	const uint32_t numChunks{ (end - begin + grainSize - 1) / grainSize };
+	const uint32_t numHelpers{ std::min(numChunks, GetNumThreads()) - 1 };
+
+	TaskGroup group{};
+	for (uint32_t i{ 0 }; i < numHelpers; ++i)
+	{
+		Submit(group, processChunks);
+	}
+
+	//the helpers reference this frame, they have to finish before an exception of the calling thread leaves it
+	std::exception_ptr exception{};
+	try
+	{
+		processChunks();
+	}
+	catch (...)
+	{
+		exception = std::current_exception();
+	}
+	Wait(group);
+
+	if (exception) std::rethrow_exception(exception);
+}
+
+void ThreadPool::WorkerLoop(uint32_t queueIdx)
+{
+	t_QueueIdx = queueIdx;
+	t_pOwnerPool = this;
+
+	while (true)
+	{
+		if (TryRunTask(queueIdx)) continue;
+
+		std::unique_lock lock{ m_SleepMutex };
+		m_SleepCondition.wait(lock, [this] { return m_Quit || m_QueuedTasks.load(std::memory_order_acquire) > 0; });
+
+		if (m_Quit) return;
+	}
+}
+
+bool ThreadPool::TryRunTask(uint32_t queueIdx)
+{
+	Task task{};
+	if (!PopTask(queueIdx, task) && !StealTask(queueIdx, task))
+		return false;
+
+	m_QueuedTasks.fetch_sub(1, std::memory_order_relaxed);
+
+	try
+	{
+		task.function();
+	}
+	catch (...)
+	{
+		std::lock_guard lock{ task.pGroup->m_ExceptionMutex };
+		if (!task.pGroup->m_Exception) task.pGroup->m_Exception = std::current_exception();
+	}
+
+	FinishTask(*task.pGroup);
+	return true;
+}
+
+void ThreadPool::FinishTask(TaskGroup& group)
+{
+	if (group.m_PendingTasks.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	//taking the lock orders this after a waiter's check of the group, so the notify can't land before it sleeps
+	{
+		std::lock_guard lock{ m_SleepMutex };
+	}
+	m_WaitCondition.notify_all();
+}
+
+bool ThreadPool::PopTask(uint32_t queueIdx, Task& task)
+{
+	WorkQueue& queue = m_Queues[queueIdx];
+	std::lock_guard lock{ queue.mutex };
+
+	if (queue.tasks.empty()) return false;
+
+	//newest first, its data is most likely still in cache
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::StealTask(uint32_t thiefIdx, Task& task)
+{
+	const uint32_t numQueues{ static_cast<uint32_t>(m_Queues.size()) };
+
+	for (uint32_t offset{ 1 }; offset < numQueues; ++offset)
+	{
+		WorkQueue& queue = m_Queues[(thiefIdx + offset) % numQueues];
+		std::lock_guard lock{ queue.mutex };
+
+		if (queue.tasks.empty()) continue;
+
+		//oldest first, it tends to be the biggest piece of work
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+uint32_t ThreadPool::GetQueueIndex() const
+{
+	return t_pOwnerPool == this ? t_QueueIdx : 0;
+}
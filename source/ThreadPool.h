@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	//Counts the unfinished tasks submitted under it, ThreadPool::Wait blocks on it
+	//Holds the first exception one of them threw until Wait rethrows it
+	class TaskGroup final
+	{
+	public:
+		TaskGroup() = default;
+		~TaskGroup() = default;
+
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup(TaskGroup&&) noexcept = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+		TaskGroup& operator=(TaskGroup&&) noexcept = delete;
+
+		bool IsDone() const { return m_PendingTasks.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class ThreadPool;
+		std::atomic<uint32_t> m_PendingTasks{ 0 };
+
+		std::mutex m_ExceptionMutex{};
+		std::exception_ptr m_Exception{};
+	};
+
+	//Persistent work-stealing thread pool shared by the renderer, BVH builds and scene updates
+	//Every worker owns a deque: it pushes and pops its own work at the back and steals from the front of the others
+	class ThreadPool final
+	{
+	public:
+		explicit ThreadPool(uint32_t numThreads = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		//Pool living for the whole process
+		static ThreadPool& Get();
+
+		//Worker threads + the thread waiting on the work
+		uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_Workers.size()) + 1; }
+
+		void Submit(TaskGroup& group, std::function<void()> task);
+
+		//Runs queued tasks on the calling thread until every task of the group is finished, safe to call from inside a task
+		//Sleeps while nothing is queued and the group's last tasks run elsewhere, then rethrows the first exception of the group
+		void Wait(TaskGroup& group);
+
+		/**
+		 * \brief Calls func on chunks of [begin, end), chunks are pulled dynamically by all threads
+		 * \param grainSize number of indices handed out at once
+		 * \param func called with the [chunkBegin, chunkEnd) range to process
+		 */
+		void ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func);
+
+	private:
+		struct Task
+		{
+			std::function<void()> function{};
+			TaskGroup* pGroup{};
+		};
+
+		struct WorkQueue
+		{
+			std::mutex mutex{};
+			std::deque<Task> tasks{};
+		};
+
+		void WorkerLoop(uint32_t queueIdx);
+		bool TryRunTask(uint32_t queueIdx);
+		void FinishTask(TaskGroup& group);
+		bool PopTask(uint32_t queueIdx, Task& task);
+		bool StealTask(uint32_t thiefIdx, Task& task);
+		uint32_t GetQueueIndex() const;
+
+		//queue 0 is shared by threads outside the pool, queue i + 1 belongs to worker i
+		std::vector<WorkQueue> m_Queues;
+		std::vector<std::thread> m_Workers{};
+
+		std::mutex m_SleepMutex{};
+		std::condition_variable m_SleepCondition{};
+		std::condition_variable m_WaitCondition{}; //threads in Wait, notified when a group finishes
+		std::atomic<uint32_t> m_QueuedTasks{ 0 }; //counted before a task is pushed, so a thief can't take it below 0
+		bool m_Quit{ false };
+	};
+}
@@ -0,0 +1,55 @@
+#include "TileScheduler.h"
+#include "MathHelpers.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace dae;
+
+TileScheduler::TileScheduler(ThreadPool& threadPool) :
+	m_ThreadPool(threadPool)
+{
+}
+
+void TileScheduler::SetFrameSize(uint32_t width, uint32_t height)
+{
+	const uint32_t tilesX{ (width + TileSize - 1) / TileSize };
+	const uint32_t tilesY{ (height + TileSize - 1) / TileSize };
+
+	std::vector<std::pair<uint32_t, Tile>> mortonTiles{};
+	mortonTiles.reserve(tilesX * tilesY);
+
+	for (uint32_t ty{ 0 }; ty < tilesY; ++ty)
+	{
+		for (uint32_t tx{ 0 }; tx < tilesX; ++tx)
+		{
+			Tile tile{ tx * TileSize, ty * TileSize, TileSize, TileSize };
+			tile.width = std::min(TileSize, width - tile.x);
+			tile.height = std::min(TileSize, height - tile.y);
+
+			mortonTiles.emplace_back(MortonEncode2D(tx, ty), tile);
+		}
+	}
+
+	//walk the tiles along a Z-curve so consecutive tiles are spatially close and hit the same BVH nodes
+	std::sort(mortonTiles.begin(), mortonTiles.end(),
+		[](const auto& a, const auto& b) { return a.first < b.first; });
+
+	m_Tiles.clear();
+	m_Tiles.reserve(mortonTiles.size());
+	for (const auto& mortonTile : mortonTiles)
+	{
+		m_Tiles.push_back(mortonTile.second);
+	}
+}
+
+void TileScheduler::Run(const std::function<void(const Tile&)>& job)
+{
+	m_ThreadPool.ParallelFor(0, static_cast<uint32_t>(m_Tiles.size()), 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t tileIdx{ begin }; tileIdx < end; ++tileIdx)
+		{
+			job(m_Tiles[tileIdx]);
+		}
+	});
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace dae
+{
+	struct Tile
+	{
+		uint32_t x{};
+		uint32_t y{};
+		uint32_t width{};
+		uint32_t height{};
+	};
+
+	class ThreadPool;
+
+	//Splits the frame into tiles walked in Morton order and hands them out to the threads of a ThreadPool
+	//Threads pull the next tile from a shared counter, so fast tiles don't leave threads idle
+	class TileScheduler final
+	{
+	public:
+		//16 pixels * 4 bytes = one 64 byte cache line per tile row, so no two threads share a line
+		static constexpr uint32_t TileSize{ 16 };
+
+		explicit TileScheduler(ThreadPool& threadPool);
+		~TileScheduler() = default;
+
+		TileScheduler(const TileScheduler&) = delete;
+		TileScheduler(TileScheduler&&) noexcept = delete;
+		TileScheduler& operator=(const TileScheduler&) = delete;
+		TileScheduler& operator=(TileScheduler&&) noexcept = delete;
+
+		void SetFrameSize(uint32_t width, uint32_t height);
+
+		/**
+		 * \brief Runs the job for every tile of the frame, the calling thread helps out and returns when all tiles are done
+		 * \param job function called once per tile
+		 */
+		void Run(const std::function<void(const Tile&)>& job);
+
+		const std::vector<Tile>& GetTiles() const { return m_Tiles; }
+
+	private:
+		ThreadPool& m_ThreadPool;
+		std::vector<Tile> m_Tiles{};
+	};
+}
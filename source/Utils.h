@@ -178,6 +178,34 @@ namespace dae
 			return HitTest_Triangle(triangle, ray, temp, true);
 		}
 
+		//Same test as HitTest_Triangle on precomputed edges, only finds t so the caller fills the hit record once for the closest one
+		//cullMode is used as is, flipping it for shadow rays is up to the caller
+		inline bool HitTest_PackedTriangle(const PackedTriangle& triangle, TriangleCullMode cullMode, const Ray& ray, float& t)
+		{
+			const Vector3 tVec{ Vector3::Cross(ray.direction, triangle.edge2) };
+			const float determinant{ Vector3::Dot(triangle.edge1, tVec) };
+
+			//culling
+			if (determinant > -.01f && determinant < .01f) return false; //ray is parallel
+			const bool isBackFacing{ determinant < 0 };
+			if (cullMode == TriangleCullMode::FrontFaceCulling && !isBackFacing) return false;
+			if (cullMode == TriangleCullMode::BackFaceCulling && isBackFacing) return false;
+
+			const float invDeterminant{ 1 / determinant };
+			const Vector3 v0ToOrigin{ ray.origin - triangle.v0 };
+
+			const float u{ Vector3::Dot(v0ToOrigin, tVec) * invDeterminant };
+			if (u < 0 || u > 1) return false;
+
+			const Vector3 qVec{ Vector3::Cross(v0ToOrigin, triangle.edge1) };
+
+			const float v{ Vector3::Dot(ray.direction, qVec) * invDeterminant };
+			if (v < 0 || u + v > 1) return false;
+
+			t = Vector3::Dot(triangle.edge2, qVec) * invDeterminant;
+			return !(t < ray.min || t * t > ray.max);
+		}
+
 
 #pragma endregion
 #pragma region TriangeMesh HitTest
@@ -207,49 +235,40 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
+		//Tests the packed faces UpdateTransforms prepared, the hit record is only filled once for the closest face
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
 			if (!SlabTest_TriangleMesh(mesh.transformedMinAABB, mesh.transformedMaxAABB, ray))
 				return false;
-			
-			Triangle t{};
-			HitRecord tmp{};
-			int normalIdx{ 0 };
 
-			for (uint32_t i = 0; i < mesh.indices.size(); i += 3)
+			//same cull mode flip for ignoreHitRecord as HitTest_Triangle
+			const TriangleCullMode cullMode{ ignoreHitRecord == true ? static_cast<TriangleCullMode>((static_cast<int>(mesh.cullMode) + 1) % 2) : mesh.cullMode };
+
+			uint32_t closestFace{ UINT32_MAX };
+			float closestT{ hitRecord.t };
+			for (uint32_t i = 0; i < mesh.packedTriangles.size(); ++i)
 			{
-				const uint32_t v0 = mesh.indices[i];
-				const uint32_t v1 = mesh.indices[i + 1];
-				const uint32_t v2 = mesh.indices[i + 2];
-				
-				//why doesn't this work
-				/*t.v0 = mesh.transformedPositions[v0];
-				t.v1 = mesh.transformedPositions[v1];
-				t.v2 = mesh.transformedPositions[v2];
-				t.normal = mesh.transformedNormals[normalIdx++];*/ 
-
-				t = { //but this does
-					mesh.transformedPositions[v0],
-					mesh.transformedPositions[v1],
-					mesh.transformedPositions[v2],
-					mesh.transformedNormals[normalIdx++]
-				};
-
-				t.cullMode = mesh.cullMode;
-				t.materialIndex = mesh.materialIndex;
-
-
-				if (GeometryUtils::HitTest_Triangle(t, ray, tmp, ignoreHitRecord))
-				{
-					if (ignoreHitRecord) return true;
+				float t;
+				if (!HitTest_PackedTriangle(mesh.packedTriangles[i], cullMode, ray, t)) continue;
+
+				if (ignoreHitRecord) return true;
 
-					if (tmp.t < hitRecord.t)
-					{
-						hitRecord = tmp;
-					}
+				if (t < closestT)
+				{
+					closestT = t;
+					closestFace = i;
 				}
 			}
 
+			if (closestFace != UINT32_MAX)
+			{
+				hitRecord.didHit = true;
+				hitRecord.materialIndex = mesh.materialIndex;
+				hitRecord.normal = mesh.transformedNormals[closestFace].Normalized();
+				hitRecord.origin = ray.origin + ray.direction * closestT;
+				hitRecord.t = closestT;
+			}
+
 			return hitRecord.didHit;
 		}
 
@@ -273,6 +292,49 @@ namespace dae
 			return HitTest_BVH(bvh, ray, tmp, true);
 		}
 
+#pragma endregion
+#pragma region Occlusion Tests
+		//ANY-HIT TESTS
+		//Same hit conditions as the closest hit tests with the object's own cull mode, nothing but the answer is computed
+		inline bool DoesHit_Sphere(const Sphere& sphere, const Ray& ray)
+		{
+			const Vector3 sphereToOrigin{ ray.origin - sphere.origin };
+			const float A{ Vector3::Dot(ray.direction, ray.direction) };
+			const float B{ Vector3::Dot(2 * ray.direction, sphereToOrigin) };
+			const float C{ Vector3::Dot(sphereToOrigin, sphereToOrigin) - (sphere.radius * sphere.radius) };
+
+			const float discriminant{ (B * B) - (4 * A * C) };
+			if (discriminant < 0) return false;
+
+			const float t{ (-B - std::sqrtf(discriminant)) / (2 * A) };
+			return !(t < ray.min || t * t > ray.max);
+		}
+
+		inline bool DoesHit_Plane(const Plane& plane, const Ray& ray)
+		{
+			const float t{ Vector3::Dot((plane.origin - ray.origin), plane.normal) / Vector3::Dot(ray.direction, plane.normal) };
+			return !(t < ray.min || t * t > ray.max);
+		}
+
+		inline bool DoesHit_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		{
+			if (!SlabTest_TriangleMesh(mesh.transformedMinAABB, mesh.transformedMaxAABB, ray))
+				return false;
+
+			//the normals are only needed for hit records, so they aren't touched
+			for (const PackedTriangle& triangle : mesh.packedTriangles)
+			{
+				float t;
+				if (HitTest_PackedTriangle(triangle, mesh.cullMode, ray, t)) return true;
+			}
+
+			return false;
+		}
+
+		inline bool DoesHit_BVH(const BVH& bvh, const Ray& ray)
+		{
+			return bvh.DoesHit(ray);
+		}
 #pragma endregion
 	}
 
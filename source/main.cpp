@@ -5,32 +5,173 @@
 #undef main
 
 //Standard includes
+#include <charconv>
+#include <cstring>
 #include <iostream>
+#include <string>
 
 //Project includes
+#include "FrameBuffer.h"
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "SelfTest.h"
 
 using namespace dae;
 
+//Command line options
+//--headless			render without a window, straight to memory
+//--scene <name>		scene class to render (default Scene_W4_ReferenceScene)
+//--width <px>			output width (default 640)
+//--height <px>		output height (default 480)
+//--frames <n>			number of frames to render in headless mode (default 1)
+//--output <file>		save the last headless frame as BMP
+//--selftest			check the batch BRDFs and SIMD::Pow against double precision references and BVH refits against fresh builds, exits with 1 on failure
+struct LaunchOptions
+{
+	bool headless{ false };
+	std::string sceneName{ "Scene_W4_ReferenceScene" };
+	uint32_t width{ 640 };
+	uint32_t height{ 480 };
+	uint32_t numFrames{ 1 };
+	std::string outputFile{};
+	bool selfTest{ false };
+};
+
+//Larger sizes are rejected rather than attempting a multi gigabyte frame buffer
+constexpr uint32_t MaxImageSize{ 16384 };
+
+//Reads a whole argument as a number in [1, maxValue], value is left untouched otherwise
+bool ParseCount(const char* text, uint32_t maxValue, uint32_t& value)
+{
+	const char* pEnd{ text + std::strlen(text) };
+	uint32_t parsed{};
+	const auto [pParsedEnd, error] { std::from_chars(text, pEnd, parsed) };
+	if (error != std::errc{} || pParsedEnd != pEnd || parsed == 0 || parsed > maxValue)
+		return false;
+
+	value = parsed;
+	return true;
+}
+
+bool ParseArguments(int argc, char* args[], LaunchOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg{ args[i] };
+		const bool hasValue{ i + 1 < argc };
+
+		if (arg == "--headless")
+			options.headless = true;
+		else if (arg == "--scene" && hasValue)
+			options.sceneName = args[++i];
+		else if (arg == "--width" && hasValue && ParseCount(args[i + 1], MaxImageSize, options.width))
+			++i;
+		else if (arg == "--height" && hasValue && ParseCount(args[i + 1], MaxImageSize, options.height))
+			++i;
+		else if (arg == "--frames" && hasValue && ParseCount(args[i + 1], UINT32_MAX, options.numFrames))
+			++i;
+		else if (arg == "--output" && hasValue)
+			options.outputFile = args[++i];
+		else if (arg == "--selftest")
+			options.selfTest = true;
+		else
+		{
+			std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void ShutDown(SDL_Window* pWindow)
 {
 	SDL_DestroyWindow(pWindow);
 	SDL_Quit();
 }
 
+int RunHeadless(const LaunchOptions& options, Scene* pScene)
+{
+	const auto pTimer = new Timer();
+	const auto pRenderer = new Renderer(static_cast<int>(options.width), static_cast<int>(options.height));
+	if (!pRenderer->GetFrameBuffer()->IsValid())
+	{
+		std::cerr << "Could not create a " << options.width << "x" << options.height << " frame buffer: " << SDL_GetError() << "\n";
+		delete pRenderer;
+		delete pTimer;
+		return 1;
+	}
+
+	pTimer->Start();
+	float totalRenderTime = 0.f;
+
+	for (uint32_t frame{ 0 }; frame < options.numFrames; ++frame)
+	{
+		pScene->Update(pTimer);
+		pRenderer->Render(pScene);
+
+		pTimer->Update();
+		totalRenderTime += pTimer->GetElapsed();
+		std::cout << "Frame " << frame << ": " << pTimer->GetElapsed() * 1000.f << " ms" << std::endl;
+	}
+	pTimer->Stop();
+
+	std::cout << "Rendered " << options.numFrames << " frames of " << options.sceneName
+		<< " at " << options.width << "x" << options.height
+		<< ", avg " << totalRenderTime * 1000.f / options.numFrames << " ms" << std::endl;
+
+	int result = 0;
+	if (!options.outputFile.empty())
+	{
+		if (!pRenderer->SaveBufferToImage(options.outputFile))
+			std::cout << "Image saved to " << options.outputFile << std::endl;
+		else
+		{
+			std::cout << "Something went wrong. Image not saved!" << std::endl;
+			result = 1;
+		}
+	}
+
+	delete pRenderer;
+	delete pTimer;
+
+	return result;
+}
+
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	LaunchOptions options{};
+	if (!ParseArguments(argc, args, options))
+		return 1;
+
+	if (options.selfTest)
+		return SelfTest::Run() ? 0 : 1;
+
+	const auto pScene = CreateScene(options.sceneName);
+	if (!pScene)
+	{
+		std::cerr << "Unknown scene: " << options.sceneName << "\n";
+		return 1;
+	}
+
+	if (options.headless)
+	{
+		SDL_Init(SDL_INIT_TIMER);
+		pScene->Initialize();
+
+		const int result = RunHeadless(options, pScene);
+
+		delete pScene;
+		SDL_Quit();
+		return result;
+	}
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
-	const uint32_t width = 640;
-	const uint32_t height = 480;
+	const uint32_t width = options.width;
+	const uint32_t height = options.height;
 
 	SDL_Window* pWindow = SDL_CreateWindow(
 		"RayTracer - Gonzalez De Muer Sacha",
@@ -39,13 +180,15 @@ int main(int argc, char* args[])
 		width, height, 0);
 
 	if (!pWindow)
+	{
+		delete pScene;
 		return 1;
+	}
 
 	//Initialize "framework"
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
 
-	const auto pScene = new Scene_W4_ReferenceScene();
 	pScene->Initialize();
 
 	//Start loop
@@ -53,7 +196,7 @@ int main(int argc, char* args[])
 	float printTimer = 0.f;
 	bool isLooping = true;
 	bool takeScreenshot = false;
-	
+
 	while (isLooping)
 	{
 		//--------- Get input events ---------
@@ -79,6 +222,12 @@ int main(int argc, char* args[])
 					pRenderer->CycleLightingMode();
 				}
 
+				//Lookup tables: slower and less accurate than exact shading, kept for comparison
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+				{
+					pRenderer->ToggleLookupTables();
+				}
+
 				if (e.key.keysym.scancode == SDL_SCANCODE_F6)
 				{
 					pTimer->StartBenchmark();
@@ -122,4 +271,4 @@ int main(int argc, char* args[])
 
 	ShutDown(pWindow);
 	return 0;
-}
\ No newline at end of file
+}